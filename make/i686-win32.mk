@@ -2,6 +2,10 @@
 # Otherwise set it to false
 USE_FONTCONFIG := false
 
+# Set to true to collect per-font statistics (see FOX_GetFontStats())
+# Leave it false for release builds; collecting then has no cost at all
+USE_STATS := false
+
 # Compiler to use during compilation
 # e.g.: gcc, x86_64-w64-mingw32-gcc, tcc, ...
 CC := i686-w64-mingw32-gcc-win32
@@ -18,6 +18,30 @@
 #ifdef FOX_USE_FONTCONFIG
 #include <fontconfig.h>
 #endif
+#include <stdio.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Batched glyph submission relies on SDL_RenderGeometry() */
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+#error "SDL_fox requires SDL 2.0.18 or newer"
+#endif
+
+/* SIMD atlas fill and UTF-8 decoding kernels, selected at runtime */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FOX_HAVE_SSE2_KERNEL
+#define FOX_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define FOX_HAVE_SSE2_KERNEL
+#include <emmintrin.h>
+#endif
 
 /******************************************************************************
  * SDL_fox library state and initialization
@@ -27,6 +51,52 @@ static enum FOX_LibraryState FOX_state = FOX_UNINITIALIZED;
 
 static FT_Library libfreetype = NULL;
 
+/* Open fonts and mapped font files, shared between FOX_OpenFont() calls */
+typedef struct FOX_FontFile FOX_FontFile;
+typedef struct FOX_SharedFont FOX_SharedFont;
+static FOX_SharedFont *FOX_fonts = NULL;
+static FOX_FontFile *FOX_files = NULL;
+static SDL_mutex *FOX_registry_lock = NULL;
+static SDL_cond *FOX_registry_cond = NULL;	/* signalled when fonts finish */
+
+static char *FOX_cache_dir = NULL;	/* see FOX_SetAtlasCacheDir() */
+
+/* Text drawn into render target textures, see FOX_RenderTextBlock() */
+typedef struct FOX_Block FOX_Block;
+static FOX_Block *FOX_blocks = NULL;	/* most recently used first */
+static FOX_Block *FOX_blocks_tail = NULL;
+static int FOX_num_blocks = 0;
+static size_t FOX_block_bytes = 0;	/* memory used by all blocks */
+static size_t FOX_block_cache_size = 16 * 1024 * 1024;
+static SDL_atomic_t FOX_target_resets;	/* SDL_RENDER_TARGETS_RESET count */
+static SDL_bool FOX_watching_resets = SDL_FALSE;
+
+#ifdef FOX_USE_FONTCONFIG
+/* A fontconfig string resolved to the font it matches */
+typedef struct FOX_FcMatch FOX_FcMatch;
+struct FOX_FcMatch {
+	char *pattern;	/* normalized fontconfig string */
+	char *path;		/* font file */
+	int index;		/* face index inside the font file */
+	int size;		/* point size */
+	FOX_FcMatch *next;
+};
+
+/* Resolved fontconfig strings, see FOX_SetFcCacheFile() */
+static FOX_FcMatch *FOX_fc_matches = NULL;
+static char *FOX_fc_cache_file = NULL;
+static SDL_Thread *FOX_fc_prewarm = NULL;	/* last FOX_PrewarmFc() thread */
+static SDL_atomic_t FOX_fc_cancel;
+
+static void FOX_ClearFcCache(void);
+#endif
+
+static void FOX_SelectFillKernel(void);
+static void FOX_SelectDecodeKernel(void);
+static void FOX_SelectBlendKernel(void);
+static void FOX_ClearRegistry(void);
+static void FOX_PurgeBlocks(FOX_Font *font);
+
 enum FOX_LibraryState FOX_WasInit(void) {
 	return FOX_state;
 }
@@ -35,13 +105,26 @@ enum FOX_LibraryState FOX_Init(void) {
 	if(!FOX_WasInit()) {
 		if(!SDL_WasInit(0)) return FOX_state;
 		if(FT_Init_FreeType(&libfreetype)) return FOX_state;
+		FOX_registry_lock = SDL_CreateMutex();
+		FOX_registry_cond = SDL_CreateCond();
+		if(!FOX_registry_lock || !FOX_registry_cond) {
+			SDL_DestroyCond(FOX_registry_cond);
+			SDL_DestroyMutex(FOX_registry_lock);
+			FT_Done_FreeType(libfreetype);
+			return FOX_state;
+		}
 		#ifdef FOX_USE_FONTCONFIG
 		if(!FcInit()) {
+			SDL_DestroyCond(FOX_registry_cond);
+			SDL_DestroyMutex(FOX_registry_lock);
 			FT_Done_FreeType(libfreetype);
 			return FOX_state;
 		}
 		#endif
 
+		FOX_SelectFillKernel();
+		FOX_SelectDecodeKernel();
+		FOX_SelectBlendKernel();
 		FOX_state = FOX_INITIALIZED;
 	}
 
@@ -50,389 +133,5230 @@ enum FOX_LibraryState FOX_Init(void) {
 
 void FOX_Exit(void) {
 	if(FOX_WasInit()) {
+		FOX_ClearBlockCache();
 		#ifdef FOX_USE_FONTCONFIG
+		FOX_ClearFcCache();
 		FcFini();
 		#endif
+		FOX_ClearRegistry();
 		FT_Done_FreeType(libfreetype);
+		SDL_DestroyCond(FOX_registry_cond);
+		FOX_registry_cond = NULL;
+		SDL_DestroyMutex(FOX_registry_lock);
+		FOX_registry_lock = NULL;
+		SDL_free(FOX_cache_dir);
+		FOX_cache_dir = NULL;
 		FOX_state = FOX_UNINITIALIZED;
 	}
 }
 
+/******************************************************************************
+ * Atlas fill kernels
+ *****************************************************************************/
+
+/* An opaque white RGBA32 pixel without its alpha channel */
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define FOX_WHITE 0x00FFFFFFu
+#define FOX_ALPHA_SHIFT 24
+#else
+#define FOX_WHITE 0xFFFFFF00u
+#define FOX_ALPHA_SHIFT 0
+#endif
+
+/* Expands a row of 8-bit coverage values into white RGBA32 pixels */
+typedef void (*FOX_FillRowFunc)(Uint32 *dst, const Uint8 *src, int width);
+
+static void FOX_FillRowScalar(Uint32 *dst, const Uint8 *src, int width) {
+	for(int x = 0; x < width; x++) {
+		dst[x] = FOX_WHITE | ((Uint32)src[x] << FOX_ALPHA_SHIFT);
+	}
+}
+
+#ifdef FOX_HAVE_SSE2_KERNEL
+#ifdef __GNUC__
+__attribute__((target("sse2")))
+#endif
+static void FOX_FillRowSSE2(Uint32 *dst, const Uint8 *src, int width) {
+	const __m128i ones = _mm_set1_epi8(-1);
+	int x = 0;
+	for(; x + 16 <= width; x += 16) {
+		/* Interleaving 0xFF bytes in front of each coverage value twice
+		 * yields the bytes 0xFF, 0xFF, 0xFF, alpha of an RGBA32 pixel. */
+		__m128i alpha = _mm_loadu_si128((const __m128i*)&src[x]);
+		__m128i lo = _mm_unpacklo_epi8(ones, alpha);
+		__m128i hi = _mm_unpackhi_epi8(ones, alpha);
+		_mm_storeu_si128((__m128i*)&dst[x], _mm_unpacklo_epi16(ones, lo));
+		_mm_storeu_si128((__m128i*)&dst[x + 4], _mm_unpackhi_epi16(ones, lo));
+		_mm_storeu_si128((__m128i*)&dst[x + 8], _mm_unpacklo_epi16(ones, hi));
+		_mm_storeu_si128((__m128i*)&dst[x + 12], _mm_unpackhi_epi16(ones, hi));
+	}
+	FOX_FillRowScalar(&dst[x], &src[x], width - x);
+}
+#endif /* FOX_HAVE_SSE2_KERNEL */
+
+#ifdef FOX_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static void FOX_FillRowAVX2(Uint32 *dst, const Uint8 *src, int width) {
+	const __m256i white = _mm256_set1_epi32(FOX_WHITE);
+	int x = 0;
+	for(; x + 8 <= width; x += 8) {
+		__m128i alpha = _mm_loadl_epi64((const __m128i*)&src[x]);
+		__m256i pixels = _mm256_slli_epi32(_mm256_cvtepu8_epi32(alpha), 24);
+		_mm256_storeu_si256((__m256i*)&dst[x], _mm256_or_si256(pixels, white));
+	}
+	FOX_FillRowScalar(&dst[x], &src[x], width - x);
+}
+#endif /* FOX_HAVE_AVX2_KERNEL */
+
+static FOX_FillRowFunc FOX_FillRow = FOX_FillRowScalar;
+
+static void FOX_SelectFillKernel(void) {
+	FOX_FillRow = FOX_FillRowScalar;
+	#ifdef FOX_HAVE_SSE2_KERNEL
+	if(SDL_HasSSE2()) FOX_FillRow = FOX_FillRowSSE2;
+	#endif
+	#ifdef FOX_HAVE_AVX2_KERNEL
+	if(SDL_HasAVX2()) FOX_FillRow = FOX_FillRowAVX2;
+	#endif
+}
+
+/* Returns the size in pixels of a freetype bitmap or SDL_FALSE if its
+ * pixel mode is not supported. LCD bitmaps store three subpixels per
+ * pixel, which are combined into one coverage value. */
+static SDL_bool FOX_BitmapSize(const FT_Bitmap *bitmap, int *w, int *h) {
+	*w = bitmap->width;
+	*h = bitmap->rows;
+	switch(bitmap->pixel_mode) {
+		case FT_PIXEL_MODE_MONO:
+		case FT_PIXEL_MODE_GRAY:
+		case FT_PIXEL_MODE_GRAY2:
+		case FT_PIXEL_MODE_GRAY4:
+		case FT_PIXEL_MODE_BGRA:
+			return SDL_TRUE;
+		case FT_PIXEL_MODE_LCD:
+			*w /= 3;
+			return SDL_TRUE;
+		case FT_PIXEL_MODE_LCD_V:
+			*h /= 3;
+			return SDL_TRUE;
+		default:
+			return SDL_FALSE;
+	}
+}
+
+/* Converts up to 256 pixels starting at column x0 of a bitmap row
+ * into 8-bit coverage values. */
+static void FOX_CoverageRow(const FT_Bitmap *bitmap, int y, int x0,
+										int width, Uint8 *coverage
+) {
+	const Uint8 *row = bitmap->buffer + y * bitmap->pitch;
+	switch(bitmap->pixel_mode) {
+		case FT_PIXEL_MODE_MONO:
+			for(int x = 0; x < width; x++) {
+				int bit = x0 + x;
+				coverage[x] = (row[bit >> 3] & (0x80 >> (bit & 7))) ? 255 : 0;
+			}
+			break;
+		case FT_PIXEL_MODE_GRAY2:
+			for(int x = 0; x < width; x++) {
+				int pixel = x0 + x;
+				int shift = 6 - (pixel & 3) * 2;
+				coverage[x] = ((row[pixel >> 2] >> shift) & 0x3) * 85;
+			}
+			break;
+		case FT_PIXEL_MODE_GRAY4:
+			for(int x = 0; x < width; x++) {
+				int pixel = x0 + x;
+				int shift = (pixel & 1) ? 0 : 4;
+				coverage[x] = ((row[pixel >> 1] >> shift) & 0xF) * 17;
+			}
+			break;
+		case FT_PIXEL_MODE_LCD:
+			for(int x = 0; x < width; x++) {
+				const Uint8 *rgb = &row[(x0 + x) * 3];
+				coverage[x] = (rgb[0] + rgb[1] + rgb[2]) / 3;
+			}
+			break;
+		case FT_PIXEL_MODE_LCD_V:
+			row = bitmap->buffer + y * 3 * bitmap->pitch;
+			for(int x = 0; x < width; x++) {
+				int pixel = x0 + x;
+				coverage[x] = (row[pixel] + row[pixel + bitmap->pitch]
+							+ row[pixel + 2 * bitmap->pitch]) / 3;
+			}
+			break;
+		default:
+			SDL_memcpy(coverage, row + x0, width);
+			break;
+	}
+}
+
+/* Copies a rendered glyph bitmap into RGBA32 pixels with the given pitch
+ * in bytes. Coverage becomes the alpha channel of white pixels; color
+ * (BGRA) bitmaps keep their colors. */
+static void FOX_BlitBitmap(const FT_Bitmap *bitmap, Uint32 *pixels, int pitch) {
+	int width, rows;
+	if(!FOX_BitmapSize(bitmap, &width, &rows)) return;
+
+	for(int y = 0; y < rows; y++) {
+		Uint32 *dst = (Uint32*)((Uint8*)pixels + y * pitch);
+
+		if(bitmap->pixel_mode == FT_PIXEL_MODE_GRAY) {
+			FOX_FillRow(dst, bitmap->buffer + y * bitmap->pitch, width);
+		} else if(bitmap->pixel_mode == FT_PIXEL_MODE_BGRA) {
+			/* Premultiplied BGRA to straight RGBA */
+			const Uint8 *src = bitmap->buffer + y * bitmap->pitch;
+			for(int x = 0; x < width; x++, src += 4) {
+				Uint8 *rgba = (Uint8*)&dst[x];
+				Uint8 a = src[3];
+				rgba[0] = a ? src[2] * 255 / a : 0;
+				rgba[1] = a ? src[1] * 255 / a : 0;
+				rgba[2] = a ? src[0] * 255 / a : 0;
+				rgba[3] = a;
+			}
+		} else {
+			Uint8 coverage[256];
+			for(int x = 0; x < width; x += 256) {
+				int count = SDL_min(256, width - x);
+				FOX_CoverageRow(bitmap, y, x, count, coverage);
+				FOX_FillRow(&dst[x], coverage, count);
+			}
+		}
+	}
+}
+
+/* Copies a rendered glyph bitmap into 8-bit coverage values with the given
+ * pitch in bytes. Color (BGRA) bitmaps are reduced to their alpha channel. */
+static void FOX_CoverBitmap(const FT_Bitmap *bitmap, Uint8 *coverage,
+														int pitch
+) {
+	int width, rows;
+	if(!FOX_BitmapSize(bitmap, &width, &rows)) return;
+
+	for(int y = 0; y < rows; y++) {
+		Uint8 *dst = coverage + y * pitch;
+		if(bitmap->pixel_mode == FT_PIXEL_MODE_BGRA) {
+			const Uint8 *src = bitmap->buffer + y * bitmap->pitch;
+			for(int x = 0; x < width; x++) {
+				dst[x] = src[x * 4 + 3];
+			}
+		} else {
+			for(int x = 0; x < width; x += 256) {
+				FOX_CoverageRow(bitmap, y, x, SDL_min(256, width - x), &dst[x]);
+			}
+		}
+	}
+}
+
 /******************************************************************************
  * UTF-8 handling
  *****************************************************************************/
 
-typedef struct {
-	unsigned char mask;
-	unsigned char lead;
-	int bits_stored;
-} FOX_Utf8;
-
-static FOX_Utf8 *FOX_utf[] = {
-	&(FOX_Utf8){0x3f, 0x80, 6},
-	&(FOX_Utf8){0x7f,    0, 7},
-	&(FOX_Utf8){0x1f, 0xc0, 5},
-	&(FOX_Utf8){0xf,  0xe0, 4},
-	&(FOX_Utf8){0x7,  0xf0, 3},
-	NULL
-};
+/* Substituted for malformed sequences */
+#define FOX_REPLACEMENT_CHAR 0xFFFD
+
+/* Copies the leading ASCII characters of a string into an array of
+ * codepoints and returns their number. */
+typedef size_t (*FOX_WidenAsciiFunc)(const Uint8 *src, size_t length,
+															Uint32 *dst);
+
+static size_t FOX_WidenAsciiScalar(const Uint8 *src, size_t length,
+															Uint32 *dst
+) {
+	size_t i = 0;
+	for(; i < length && src[i] < 0x80; i++) {
+		dst[i] = src[i];
+	}
+	return i;
+}
+
+#ifdef FOX_HAVE_SSE2_KERNEL
+#ifdef __GNUC__
+__attribute__((target("sse2")))
+#endif
+static size_t FOX_WidenAsciiSSE2(const Uint8 *src, size_t length,
+															Uint32 *dst
+) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i*)&src[i]);
+		if(_mm_movemask_epi8(bytes)) break;
+		__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+		__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)&dst[i + 4], _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i*)&dst[i + 8], _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i*)&dst[i + 12], _mm_unpackhi_epi16(hi, zero));
+	}
+	return i + FOX_WidenAsciiScalar(&src[i], length - i, &dst[i]);
+}
+#endif /* FOX_HAVE_SSE2_KERNEL */
+
+#ifdef FOX_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static size_t FOX_WidenAsciiAVX2(const Uint8 *src, size_t length,
+															Uint32 *dst
+) {
+	size_t i = 0;
+	for(; i + 32 <= length; i += 32) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i*)&src[i]);
+		if(_mm256_movemask_epi8(bytes)) break;
+		for(int j = 0; j < 32; j += 8) {
+			__m128i chunk = _mm_loadl_epi64((const __m128i*)&src[i + j]);
+			_mm256_storeu_si256((__m256i*)&dst[i + j],
+									_mm256_cvtepu8_epi32(chunk));
+		}
+	}
+	return i + FOX_WidenAsciiScalar(&src[i], length - i, &dst[i]);
+}
+#endif /* FOX_HAVE_AVX2_KERNEL */
+
+static FOX_WidenAsciiFunc FOX_WidenAscii = FOX_WidenAsciiScalar;
+
+static void FOX_SelectDecodeKernel(void) {
+	FOX_WidenAscii = FOX_WidenAsciiScalar;
+	#ifdef FOX_HAVE_SSE2_KERNEL
+	if(SDL_HasSSE2()) FOX_WidenAscii = FOX_WidenAsciiSSE2;
+	#endif
+	#ifdef FOX_HAVE_AVX2_KERNEL
+	if(SDL_HasAVX2()) FOX_WidenAscii = FOX_WidenAsciiAVX2;
+	#endif
+}
+
+/* Decodes the character at the beginning of a string of at most length
+ * bytes and returns the number of bytes it occupies. Malformed sequences
+ * (invalid lead or continuation bytes, overlong forms, surrogates and
+ * values above U+10FFFF) decode to U+FFFD, consuming their longest valid
+ * prefix, so decoding never runs past a terminating null byte. */
+static int FOX_Utf8Next(const Uint8 *text, size_t length, Uint32 *ch) {
+	Uint8 lead = text[0];
+	Uint8 lower = 0x80, upper = 0xBF;	/* valid range of the next byte */
+	Uint32 codep;
+	int bytes;
+
+	if(lead < 0x80) {
+		*ch = lead;
+		return 1;
+	} else if(lead < 0xC2) {
+		*ch = FOX_REPLACEMENT_CHAR;
+		return 1;
+	} else if(lead < 0xE0) {
+		bytes = 2;
+		codep = lead & 0x1F;
+	} else if(lead < 0xF0) {
+		bytes = 3;
+		codep = lead & 0x0F;
+		if(lead == 0xE0) lower = 0xA0;
+		if(lead == 0xED) upper = 0x9F;
+	} else if(lead < 0xF5) {
+		bytes = 4;
+		codep = lead & 0x07;
+		if(lead == 0xF0) lower = 0x90;
+		if(lead == 0xF4) upper = 0x8F;
+	} else {
+		*ch = FOX_REPLACEMENT_CHAR;
+		return 1;
+	}
+
+	for(int i = 1; i < bytes; i++) {
+		if((size_t)i >= length || text[i] < lower || text[i] > upper) {
+			*ch = FOX_REPLACEMENT_CHAR;
+			return i;
+		}
+		codep = (codep << 6) | (text[i] & 0x3F);
+		lower = 0x80;
+		upper = 0xBF;
+	}
+
+	*ch = codep;
+	return bytes;
+}
+
+/* Decodes the character at the beginning of a null-terminated string and
+ * points endptr to the last byte of its sequence. */
+static Uint32 FOX_Utf8Decode(const Uint8* sequence, const Uint8** endptr) {
+	Uint32 ch;
+	*endptr = sequence + FOX_Utf8Next(sequence, (size_t)-1, &ch) - 1;
+	return ch;
+}
+
+/* Number of ASCII characters a FOX_Utf8Reader widens at once */
+#define FOX_READ_AHEAD 64
+
+/* Reads a utf-8 string one character at a time for the layout loops.
+ * Runs of ASCII characters, which most text consists of, are widened
+ * ahead with FOX_WidenAscii() like FOX_DecodeUtf8() does. That takes
+ * the end of the string; null-terminated strings of unknown length are
+ * decoded one character at a time, so they are never read past the
+ * terminating null byte. */
+typedef struct FOX_Utf8Reader {
+	const Uint8 *text;	/* next character */
+	const Uint8 *end;	/* end of the string, NULL if unknown */
+	int next;			/* next widened character */
+	int num_ascii;		/* number of widened characters */
+	Uint32 ascii[FOX_READ_AHEAD];	/* ASCII characters starting at text */
+} FOX_Utf8Reader;
+
+static void FOX_StartReader(FOX_Utf8Reader *reader, const Uint8 *text,
+													const Uint8 *end
+) {
+	reader->text = text;
+	reader->end = end;
+	reader->next = 0;
+	reader->num_ascii = 0;
+}
+
+/* Reads the next character and advances past it. Returns SDL_FALSE at
+ * the end of the string. */
+static SDL_bool FOX_ReadChar(FOX_Utf8Reader *reader, Uint32 *ch) {
+	if(reader->next < reader->num_ascii) {
+		*ch = reader->ascii[reader->next++];
+		reader->text++;
+		return SDL_TRUE;
+	}
+
+	const Uint8 *text = reader->text;
+	if(!reader->end) {
+		if(!*text) return SDL_FALSE;
+		reader->text += FOX_Utf8Next(text, (size_t)-1, ch);
+		return SDL_TRUE;
+	}
+	if(text >= reader->end) return SDL_FALSE;
+
+	size_t length = (size_t)(reader->end - text);
+	if(*text < 0x80) {
+		reader->num_ascii = (int)FOX_WidenAscii(text,
+					SDL_min(length, FOX_READ_AHEAD), reader->ascii);
+		reader->next = 1;
+		*ch = reader->ascii[0];
+		reader->text++;
+		return SDL_TRUE;
+	}
+	reader->text += FOX_Utf8Next(text, length, ch);
+	return SDL_TRUE;
+}
+
+size_t FOX_DecodeUtf8(const Uint8 *text, size_t length, Uint32 *codepoints,
+						size_t max_codepoints, const Uint8 **endptr
+) {
+	size_t i = 0, count = 0;
+	while(i < length && count < max_codepoints) {
+		size_t ascii = FOX_WidenAscii(&text[i],
+				SDL_min(length - i, max_codepoints - count), &codepoints[count]);
+		i += ascii;
+		count += ascii;
+		if(i < length && count < max_codepoints && text[i] >= 0x80) {
+			i += FOX_Utf8Next(&text[i], length - i, &codepoints[count++]);
+		}
+	}
+
+	if(endptr) *endptr = &text[i];
+	return count;
+}
+
+/******************************************************************************
+ * Font definition and open/close
+ *****************************************************************************/
+
+/* Glyph quads queued for submission via a single SDL_RenderGeometry() */
+typedef struct {
+	SDL_Vertex *vertices;	/* 4 vertices per quad */
+	int *indices;			/* 6 indices per quad, prefilled on growth */
+	int count;				/* number of queued quads */
+	int capacity;			/* number of quads the buffers can hold */
+} FOX_Batch;
+
+/* A horizontal segment of the skyline at height y */
+typedef struct {
+	int x, y, w;
+} FOX_SkylineNode;
+
+/* One atlas texture, packed with glyphs using the skyline algorithm */
+typedef struct {
+	SDL_Texture *texture;
+	SDL_Surface *surface;	/* pixels prior to upload (static atlas only) */
+	Uint8 *coverage;		/* w * h coverage values (FOX_OPEN_SURFACE only) */
+	int w, h;
+	FOX_SkylineNode *skyline;	/* sorted by x, spans the page width */
+	int nodes;
+	int used;				/* pixels covered by glyphs */
+	FOX_Batch batch;		/* quads queued for this page */
+	FT_UInt *glyphs;		/* glyphs placed on the page (dynamic atlas only) */
+	int num_glyphs;
+	int glyph_capacity;
+	Uint64 last_used;		/* clock of the font when last queued or drawn */
+} FOX_AtlasPage;
+
+/* Rasterization state of a glyph */
+enum FOX_GlyphState {
+	FOX_GLYPH_EMPTY,	/* not rasterized yet */
+	FOX_GLYPH_LOADED,	/* metrics are valid and the glyph is in the atlas */
+	FOX_GLYPH_FAILED	/* rasterization failed or the atlas is full */
+};
+
+typedef struct {
+	FOX_GlyphMetrics metrics;
+	Uint16 page;	/* atlas page containing the glyph */
+	Uint8 state;
+} FOX_Glyph;
+
+/* The codepoint to glyph index table is split into pages of 256
+ * characters, which are allocated on first use. */
+#define FOX_CHARMAP_SHIFT 8
+#define FOX_CHARMAP_PAGES (0x110000 >> FOX_CHARMAP_SHIFT)
+#define FOX_CHARMAP_MASK ((1 << FOX_CHARMAP_SHIFT) - 1)
+#define FOX_CHARMAP_UNKNOWN 0xFFFFFFFF	/* not looked up yet */
+
+/* Fonts searched for characters missing from a font. The fallback map
+ * holds 1 + the index of the fallback providing a character. */
+#define FOX_MAX_FALLBACKS 254
+#define FOX_FALLBACK_UNKNOWN 0	/* not looked up yet */
+#define FOX_FALLBACK_NONE 0xFF	/* missing from all fallbacks */
+
+/* Characters whose kerning pairs are kept in a dense matrix. Can be
+ * overridden at build time to cover another range. */
+#ifndef FOX_KERNING_FIRST
+#define FOX_KERNING_FIRST 0x20
+#endif
+#ifndef FOX_KERNING_LAST
+#define FOX_KERNING_LAST 0xFF
+#endif
+#define FOX_KERNING_RANGE (FOX_KERNING_LAST - FOX_KERNING_FIRST + 1)
+
+/* A kerning pair of glyph indices outside of the dense range */
+typedef struct {
+	FT_UInt previous, index;	/* previous == 0 marks an empty slot */
+	int offset;
+} FOX_KerningPair;
+
+typedef struct {
+	Sint16 *matrix;		/* offsets indexed by [previous][ch] */
+	Uint8 *rows;		/* whether a row of the matrix has been computed */
+	FOX_KerningPair *pairs;	/* open addressing hash table */
+	int num_pairs;
+	int capacity;
+} FOX_KerningCache;
+
+/* Counters behind FOX_GetFontStats(), times in performance counter ticks */
+typedef struct {
+	Uint64 glyphs_rendered;
+	Uint64 draw_calls;
+	Uint64 glyph_hits;
+	Uint64 glyph_misses;
+	Uint64 glyphs_rasterized;
+	Uint64 glyphs_evicted;
+	Uint64 kerning_lookups;
+	Uint64 kerning_misses;
+	Uint64 lines_laid_out;
+	Uint64 open_ticks;
+	Uint64 rasterize_ticks;
+	Uint64 layout_ticks;
+} FOX_Stats;
+
+/* Statistics are only collected if built with FOX_USE_STATS; otherwise
+ * the macros compile to nothing. */
+#ifdef FOX_USE_STATS
+#define FOX_COUNT(font, counter, n) ((font)->stats.counter += (n))
+#define FOX_TIMESTAMP() SDL_GetPerformanceCounter()
+#define FOX_TIME(font, counter, start) \
+	((font)->stats.counter += SDL_GetPerformanceCounter() - (start))
+#else
+#define FOX_COUNT(font, counter, n) ((void)0)
+#define FOX_TIMESTAMP() 0
+#define FOX_TIME(font, counter, start) ((void)(start))
+#endif
+
+/* A surface being rendered to, see FOX_RenderTextToSurface() */
+typedef struct FOX_Target FOX_Target;
+
+/* The contents of a font, shared by the faces of all fonts opened from it.
+ * Font files are mapped into memory, memory passed to FOX_OpenFontMem() is
+ * used as is and streams are read by freetype on demand. */
+struct FOX_FontFile {
+	char *path;		/* NULL unless opened from a file */
+	void *data;		/* contents of the font, NULL if streamed */
+	size_t size;
+	SDL_RWops *src;	/* stream the font is read from */
+	SDL_bool freesrc;	/* close the stream along with the font */
+	Sint64 offset;	/* of the font inside the stream */
+	FT_StreamRec stream;
+	int refcount;
+	FOX_FontFile *next;
+};
+
+/* A face opened at one size for one renderer along with its atlas,
+ * glyphs and kerning. It is shared by the handles of all FOX_OpenFont()
+ * calls for it and by the fallback chains it is part of. */
+struct FOX_SharedFont {
+	SDL_Renderer *renderer;
+	FOX_AtlasPage *pages;
+	int num_pages;
+	int page_size;	/* side length of newly created atlas pages */
+	FOX_Glyph *glyphs;	/* indexed by freetype glyph index */
+	Uint32 *charmap[FOX_CHARMAP_PAGES];	/* codepoint to glyph index */
+	FT_Face face;	/* freetype font face */
+	FOX_FontFile *file;	/* font file contents shared with other fonts */
+	FOX_FontMetrics size;
+	FOX_KerningCache kerning;
+	Uint32 flags;	/* enum FOX_OpenFlags */
+	SDL_Surface *scratch;	/* glyph upload buffer (dynamic atlas) */
+	SDL_Color color;	/* vertex color of the current batch */
+	int refcount;	/* number of handles and fallback chains using it */
+	FOX_SharedFont *next;	/* next open font of the registry */
+	FOX_Font *handles;	/* handles of the FOX_OpenFont() calls for it */
+	Uint32 evictions;	/* bumped whenever glyphs are evicted */
+	size_t atlas_budget;	/* bytes the atlas may occupy, 0 if unlimited */
+	int max_pages;	/* number of pages within the budget */
+	Uint64 clock;	/* advanced whenever a page is used */
+	Uint64 pinned;	/* pages used since this clock are not evicted, 0 if none
+					 * are, see FOX_PinPages() */
+	FOX_Target *target;	/* surface glyphs are blended into right away */
+	int index;	/* of the face within the font file */
+	int max_texture_size;	/* of the renderer, so atlases can be built
+						 * off the render thread */
+	int state;	/* enum FOX_FontState */
+	SDL_bool claimed;	/* a thread is loading or finishing the font */
+	SDL_Thread *loader;	/* thread of FOX_OpenFontAsync() */
+	SDL_atomic_t loaded;	/* set by the loader to the resulting state */
+	SDL_atomic_t cancel;	/* tells the loader to give up */
+	#ifdef FOX_USE_STATS
+	FOX_Stats stats;
+	#endif
+};
+
+/* The handle returned by a FOX_OpenFont() call. It carries the settings
+ * of the caller, so that callers opening the same font do not change the
+ * fonts of each other. Fallback chains hold fonts rather than handles,
+ * which do not pass on their own chains and can never form a cycle. */
+struct FOX_Font {
+	FOX_SharedFont *shared;	/* face and atlas shared with other handles */
+	SDL_bool use_kerning;
+	FOX_SharedFont **fallbacks;	/* searched in order for missing characters */
+	int num_fallbacks;
+	Uint8 *fallback_map[FOX_CHARMAP_PAGES];	/* codepoint to fallback */
+	SDL_bool fc_fallback;	/* ask fontconfig for more fallbacks */
+	Uint32 generation;	/* bumped whenever laid out text may change */
+	FOX_Font *next;	/* next handle of the same font */
+};
+
+#ifdef FOX_USE_FONTCONFIG
+static SDL_bool FOX_ResolveFcPattern(const unsigned char *fontstr,
+										FOX_FcMatch *match);
+
+FOX_Font* FOX_OpenFontFc(SDL_Renderer *renderer, const unsigned char *fontstr) {
+	return FOX_OpenFontFcEx(renderer, fontstr, FOX_OPEN_DEFAULT);
+}
+
+FOX_Font* FOX_OpenFontFcEx(SDL_Renderer *renderer,
+					const unsigned char *fontstr, Uint32 flags
+) {
+	FOX_FcMatch match;
+	if(!FOX_ResolveFcPattern(fontstr, &match)) return NULL;
+
+	FOX_Font *font = FOX_OpenFontIndex(renderer, match.path, match.index,
+												match.size, flags);
+	SDL_free(match.path);
+	return font;
+}
+#endif /* FOX_USE_FONTCONFIG */
+
+static SDL_bool FOX_RenderFontToPages(FOX_SharedFont *font);
+static SDL_bool FOX_RenderFontToPagesParallel(FOX_SharedFont *font);
+static SDL_bool FOX_UploadPages(FOX_SharedFont *font);
+static int FOX_ChoosePageSize(FOX_SharedFont *font);
+static int FOX_MaxTextureSize(SDL_Renderer *renderer);
+static void FOX_FreePages(FOX_SharedFont *font);
+static void FOX_LimitAtlas(FOX_SharedFont *font, size_t bytes);
+static void FOX_FreeCharmap(FOX_SharedFont *font);
+static void FOX_PrecomputeKerning(FOX_SharedFont *font);
+static void FOX_FreeKerning(FOX_SharedFont *font);
+static void FOX_TrimPages(FOX_SharedFont *font);
+static char* FOX_AtlasCachePath(const char *path, int index, int size);
+static SDL_bool FOX_LoadAtlasCache(FOX_SharedFont *font, const char *path,
+									const char *cache, SDL_bool upload);
+static void FOX_SaveAtlasCache(FOX_SharedFont *font, const char *path,
+													const char *cache);
+static FOX_SharedFont* FOX_FindFont(SDL_Renderer *renderer,
+			const char *path, const void *data, int index, int size,
+			Uint32 flags, size_t budget);
+static void FOX_RegisterFont(FOX_SharedFont *font);
+static void FOX_RetainFont(FOX_SharedFont *font);
+static SDL_bool FOX_UnregisterFont(FOX_SharedFont *font);
+static int FOX_CountUsers(FOX_SharedFont *font);
+static void FOX_AttachHandle(FOX_Font *font, FOX_SharedFont *shared);
+static void FOX_DetachHandle(FOX_Font *font);
+static void FOX_FreeFallbackMap(FOX_Font *font);
+static FOX_FontFile* FOX_AcquireFontFile(const char *path);
+static FOX_FontFile* FOX_WrapFontMem(const void *data, size_t size);
+static FOX_FontFile* FOX_WrapFontRW(SDL_RWops *src, int freesrc);
+static FT_Error FOX_OpenFace(FOX_FontFile *file, int index, FT_Face *face);
+static void FOX_CloseFace(FT_Face face);
+static void FOX_ReleaseFontFile(FOX_FontFile *file);
+
+FOX_Font* FOX_OpenFont(SDL_Renderer *renderer, const char *path, int size) {
+	return FOX_OpenFontEx(renderer, path, size, FOX_OPEN_DEFAULT);
+}
+
+/* Creates a font that still has to be loaded with FOX_LoadFont(), not
+ * taking the registry into account. Takes over the reference to the file. */
+static FOX_SharedFont* FOX_NewFont(SDL_Renderer *renderer, FOX_FontFile *file,
+										int index, int size, Uint32 flags
+) {
+	FOX_SharedFont *font = SDL_calloc(1, sizeof(*font));
+	if(!font) {
+		FOX_ReleaseFontFile(file);
+		return NULL;
+	}
+	font->renderer = flags & FOX_OPEN_SURFACE ? NULL : renderer;
+	font->flags = flags;
+	font->file = file;
+	font->index = index;
+	font->size.ptsize = size;
+	font->max_texture_size = FOX_MaxTextureSize(font->renderer);
+	font->state = FOX_FONT_LOADING;
+	return font;
+}
+
+/* Frees everything set up by FOX_LoadFont(). */
+static void FOX_UnloadFont(FOX_SharedFont *font) {
+	FOX_FreePages(font);
+	SDL_FreeSurface(font->scratch);
+	font->scratch = NULL;
+	FOX_FreeCharmap(font);
+	FOX_FreeKerning(font);
+	SDL_free(font->glyphs);
+	font->glyphs = NULL;
+	FOX_CloseFace(font->face);
+	font->face = NULL;
+}
+
+/* Opens the face of a font and builds its atlas. Textures are only created
+ * if upload is set; otherwise the pages of a static atlas are left as
+ * surfaces for FOX_UploadPages(), so that this can run on any thread. */
+static SDL_bool FOX_LoadFont(FOX_SharedFont *font, SDL_bool upload) {
+	int index = font->index, size = font->size.ptsize;
+
+	/* Open the face using libfreetype. The contents of the font are
+	 * shared with all other fonts and rasterization workers using it. */
+	if(index < 0 || FOX_OpenFace(font->file, index, &font->face)) {
+		SDL_SetError("Failed to open face %d of the font", index);
+		font->face = NULL;
+		return SDL_FALSE;
+	}
+
+	/* Set the pixel size for rendering characters */
+	if(FT_Set_Pixel_Sizes(font->face, size, size)) {
+		goto abort;
+	}
+
+	/* Allocate glyph array */
+	font->glyphs = SDL_calloc(font->face->num_glyphs, sizeof(*font->glyphs));
+	if(!font->glyphs) goto abort;
+
+	/* Set font parameters */
+	font->size.height = font->face->size->metrics.height >> 6;
+	font->page_size = FOX_ChoosePageSize(font);
+
+	if(font->flags & FOX_OPEN_DYNAMIC) {
+		/* Without rasterizing every glyph, take the maxima from the face */
+		FT_Size_Metrics *metrics = &font->face->size->metrics;
+		font->size.max_advance = metrics->max_advance >> 6;
+		if(FT_IS_SCALABLE(font->face)) {
+			FT_BBox *bbox = &font->face->bbox;
+			font->size.max_width = FT_MulFix(bbox->xMax - bbox->xMin,
+											metrics->x_scale) >> 6;
+			font->size.max_height = FT_MulFix(bbox->yMax - bbox->yMin,
+											metrics->y_scale) >> 6;
+		}
+
+		/* Glyphs are rasterized on first use */
+		return SDL_TRUE;
+	}
+
+	/* Reuse the atlas of a previous run if it has been cached. Coverage
+	 * atlases are cheap to rebuild compared to textures, so they are not.
+	 * Neither are the atlases of fonts that were not opened from a file. */
+	const char *path = font->file->path;
+	char *cache = font->flags & FOX_OPEN_SURFACE || !path ? NULL
+								: FOX_AtlasCachePath(path, index, size);
+	if(cache && FOX_LoadAtlasCache(font, path, cache, upload)) {
+		SDL_free(cache);
+		FOX_PrecomputeKerning(font);
+		return SDL_TRUE;
+	}
+
+	/* Render characters to atlas pages and upload them as textures.
+	 * Streams can only be read by one face at a time. */
+	Uint64 raster_start = FOX_TIMESTAMP();
+	SDL_bool rendered = font->flags & FOX_OPEN_PARALLEL && font->file->data
+								? FOX_RenderFontToPagesParallel(font)
+								: FOX_RenderFontToPages(font);
+	FOX_TIME(font, rasterize_ticks, raster_start);
+	if(rendered) {
+		FOX_TrimPages(font);
+		if(cache) FOX_SaveAtlasCache(font, path, cache);
+	}
+	SDL_free(cache);
+	if(!rendered || (upload && !FOX_UploadPages(font))) {
+		goto abort;
+	}
+	FOX_PrecomputeKerning(font);
+
+	return SDL_TRUE;
+
+	/* Premature error handling */
+	abort:
+		FOX_UnloadFont(font);
+		return SDL_FALSE;
+}
+
+/* Frees a font along with its loader and file, not taking the registry
+ * into account. */
+static void FOX_FreeFont(FOX_SharedFont *font) {
+	if(font->loader) {
+		SDL_AtomicSet(&font->cancel, 1);
+		SDL_WaitThread(font->loader, NULL);
+	}
+	FOX_UnloadFont(font);
+	FOX_ReleaseFontFile(font->file);
+	SDL_free(font);
+}
+
+/* Drops a reference to a font, freeing it along with the last one. */
+static void FOX_ReleaseFont(FOX_SharedFont *font) {
+	if(FOX_UnregisterFont(font)) FOX_FreeFont(font);
+}
+
+/* Creates a new font from face index of a font file, not taking the
+ * registry into account. Takes over the reference to the file. */
+static FOX_SharedFont* FOX_CreateFont(SDL_Renderer *renderer,
+			FOX_FontFile *file, int index, int size, Uint32 flags
+) {
+	Uint64 start = FOX_TIMESTAMP();
+	FOX_SharedFont *font = FOX_NewFont(renderer, file, index, size, flags);
+	if(!font) return NULL;
+
+	if(!FOX_LoadFont(font, SDL_TRUE)) {
+		FOX_FreeFont(font);
+		return NULL;
+	}
+	font->state = FOX_FONT_READY;
+	FOX_TIME(font, open_ticks, start);
+
+	return font;
+}
+
+/* Sets the state of a font once it is done loading and wakes up the
+ * threads waiting for it. */
+static void FOX_SettleFont(FOX_SharedFont *font, int state) {
+	SDL_LockMutex(FOX_registry_lock);
+	font->state = state;
+	SDL_CondBroadcast(FOX_registry_cond);
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+static void FOX_FinishFont(FOX_SharedFont *font, SDL_bool wait);
+
+/* Waits for a font taken from the registry that may still be loaded by
+ * another thread. Drops the reference if loading it failed. */
+static FOX_SharedFont* FOX_AwaitFont(FOX_SharedFont *font) {
+	if(font->state == FOX_FONT_LOADING) FOX_FinishFont(font, SDL_TRUE);
+	if(font->state != FOX_FONT_READY) {
+		SDL_SetError("Failed to load font");
+		FOX_ReleaseFont(font);
+		return NULL;
+	}
+	return font;
+}
+
+/* Creates a font from a font file and adds it to the registry. */
+static FOX_SharedFont* FOX_AddFont(SDL_Renderer *renderer,
+			FOX_FontFile *file, int index, int size, Uint32 flags
+) {
+	if(!file) return NULL;
+	FOX_SharedFont *font = FOX_CreateFont(renderer, file, index, size,
+																flags);
+	if(font) FOX_RegisterFont(font);
+	return font;
+}
+
+/* Takes another reference to a font opened from a file, or from memory
+ * if path is NULL, with an atlas of at most budget bytes (unlimited if 0).
+ * The font is opened if it has not been before. */
+static FOX_SharedFont* FOX_ShareFont(SDL_Renderer *renderer,
+			const char *path, const void *data, size_t datasize,
+			int index, int size, Uint32 flags, size_t budget
+) {
+	/* The font is looked up and registered under one lock, so that it is
+	 * only loaded once. Others opening it meanwhile wait for it. */
+	SDL_LockMutex(FOX_registry_lock);
+	FOX_SharedFont *font = FOX_FindFont(renderer, path, data, index, size,
+														flags, budget);
+	if(font) {
+		SDL_UnlockMutex(FOX_registry_lock);
+		return FOX_AwaitFont(font);
+	}
+	FOX_FontFile *file = path ? FOX_AcquireFontFile(path)
+								: FOX_WrapFontMem(data, datasize);
+	if(file) font = FOX_NewFont(renderer, file, index, size, flags);
+	if(font) {
+		font->atlas_budget = budget;
+		font->claimed = SDL_TRUE;
+		FOX_RegisterFont(font);
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	if(!font) return NULL;
+
+	Uint64 start = FOX_TIMESTAMP();
+	if(!FOX_LoadFont(font, SDL_TRUE)) {
+		FOX_SettleFont(font, FOX_FONT_FAILED);
+		FOX_ReleaseFont(font);
+		return NULL;
+	}
+	if(budget) FOX_LimitAtlas(font, budget);
+	FOX_TIME(font, open_ticks, start);
+	FOX_SettleFont(font, FOX_FONT_READY);
+	return font;
+}
+
+/* Wraps a font into a new handle with the default settings. Takes over
+ * the reference to the font, which is dropped on error. */
+static FOX_Font* FOX_NewHandle(FOX_SharedFont *shared) {
+	if(!shared) return NULL;
+	FOX_Font *font = SDL_calloc(1, sizeof(*font));
+	if(!font) {
+		FOX_ReleaseFont(shared);
+		return NULL;
+	}
+	font->use_kerning = SDL_TRUE;	/* unless the face has no kerning */
+	FOX_AttachHandle(font, shared);
+	return font;
+}
+
+FOX_Font* FOX_OpenFontEx(SDL_Renderer *renderer, const char *path, int size,
+															Uint32 flags
+) {
+	return FOX_OpenFontIndex(renderer, path, 0, size, flags);
+}
+
+FOX_Font* FOX_OpenFontIndex(SDL_Renderer *renderer, const char *path,
+								int index, int size, Uint32 flags
+) {
+	/* Share the font if it has been opened before */
+	return FOX_NewHandle(FOX_ShareFont(renderer, path, NULL, 0, index, size,
+															flags, 0));
+}
+
+FOX_Font* FOX_OpenFontMem(SDL_Renderer *renderer, const void *data,
+				size_t datasize, int index, int size, Uint32 flags
+) {
+	return FOX_NewHandle(FOX_ShareFont(renderer, NULL, data, datasize,
+										index, size, flags, 0));
+}
+
+FOX_Font* FOX_OpenFontRW(SDL_Renderer *renderer, SDL_RWops *src,
+				int freesrc, int index, int size, Uint32 flags
+) {
+	/* Streamed fonts are never shared */
+	return FOX_NewHandle(FOX_AddFont(renderer, FOX_WrapFontRW(src, freesrc),
+												index, size, flags));
+}
+
+/* Loads a font opened with FOX_OpenFontAsync(), leaving the creation of
+ * its textures to the render thread. */
+static int SDLCALL FOX_LoadWorker(void *data) {
+	FOX_SharedFont *font = data;
+	Uint64 start = FOX_TIMESTAMP();
+	SDL_bool loaded = FOX_LoadFont(font, SDL_FALSE);
+	FOX_TIME(font, open_ticks, start);
+	SDL_AtomicSet(&font->loaded, loaded ? FOX_FONT_READY : FOX_FONT_FAILED);
+	return 0;
+}
+
+FOX_Font* FOX_OpenFontAsync(SDL_Renderer *renderer, const char *path,
+											int size, Uint32 flags
+) {
+	return FOX_OpenFontAsyncIndex(renderer, path, 0, size, flags);
+}
+
+FOX_Font* FOX_OpenFontAsyncIndex(SDL_Renderer *renderer, const char *path,
+								int index, int size, Uint32 flags
+) {
+	/* As in FOX_ShareFont(), the font is only started once */
+	SDL_LockMutex(FOX_registry_lock);
+	FOX_SharedFont *font = FOX_FindFont(renderer, path, NULL, index, size,
+															flags, 0);
+	if(!font) {
+		/* Mapping the file is cheap, opening the face is left to the
+		 * loader */
+		FOX_FontFile *file = FOX_AcquireFontFile(path);
+		if(file) font = FOX_NewFont(renderer, file, index, size, flags);
+		if(font) {
+			font->loader = SDL_CreateThread(FOX_LoadWorker, "FOX_Loader",
+																font);
+			if(font->loader) {
+				FOX_RegisterFont(font);
+			} else {
+				FOX_FreeFont(font);
+				font = NULL;
+			}
+		}
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	return FOX_NewHandle(font);
+}
+
+/* Finishes a font once its loader is done by creating the textures of its
+ * atlas. Only the thread claiming the font does so; others wait until it
+ * is done if wait is set. */
+static void FOX_FinishFont(FOX_SharedFont *font, SDL_bool wait) {
+	SDL_LockMutex(FOX_registry_lock);
+	SDL_bool claimed = font->claimed;
+	font->claimed = SDL_TRUE;
+	while(claimed && wait && font->state == FOX_FONT_LOADING) {
+		SDL_CondWait(FOX_registry_cond, FOX_registry_lock);
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	if(claimed) return;
+
+	SDL_WaitThread(font->loader, NULL);
+	font->loader = NULL;
+
+	Uint64 start = FOX_TIMESTAMP();
+	int state = FOX_FONT_READY;
+	if(SDL_AtomicGet(&font->loaded) != FOX_FONT_READY
+		|| !FOX_UploadPages(font)
+	) {
+		SDL_SetError("Failed to load font %s", font->file->path);
+		FOX_UnloadFont(font);
+		state = FOX_FONT_FAILED;
+	}
+	FOX_TIME(font, open_ticks, start);
+	FOX_SettleFont(font, state);
+}
+
+enum FOX_FontState FOX_PollFont(FOX_Font *font) {
+	FOX_SharedFont *shared = font->shared;
+	if(shared->state == FOX_FONT_LOADING
+		&& SDL_AtomicGet(&shared->loaded) != FOX_FONT_LOADING
+	) {
+		FOX_FinishFont(shared, SDL_FALSE);
+	}
+	return shared->state;
+}
+
+enum FOX_FontState FOX_WaitFont(FOX_Font *font) {
+	FOX_SharedFont *shared = font->shared;
+	if(shared->state == FOX_FONT_LOADING) FOX_FinishFont(shared, SDL_TRUE);
+	return shared->state;
+}
+
+/* Returns whether a font can be used. Fonts opened with
+ * FOX_OpenFontAsync() are finished here once they are done loading. */
+static SDL_bool FOX_FontReady(FOX_Font *font) {
+	return font->shared->state == FOX_FONT_READY
+		|| FOX_PollFont(font) == FOX_FONT_READY;
+}
+
+void FOX_CloseFont(FOX_Font *font) {
+	if(!font) return;
+	FOX_PurgeBlocks(font);
+	FOX_ClearFallbackFonts(font);
+	FOX_DetachHandle(font);
+	FOX_ReleaseFont(font->shared);
+	SDL_free(font);
+}
+
+/******************************************************************************
+ * Font registry
+ *****************************************************************************/
+
+static void* FOX_MapFile(const char *path, size_t *size);
+static void FOX_UnmapFile(void *data, size_t size);
+
+/* Finds a font opened from a file or from memory and takes another
+ * reference to it. Fonts with an atlas budget are only found for the
+ * same budget, fonts that failed to load are not found at all. */
+static FOX_SharedFont* FOX_FindFont(SDL_Renderer *renderer,
+			const char *path, const void *data, int index, int size,
+			Uint32 flags, size_t budget
+) {
+	/* Surface fonts do not use a renderer */
+	if(flags & FOX_OPEN_SURFACE) renderer = NULL;
+
+	SDL_LockMutex(FOX_registry_lock);
+	FOX_SharedFont *font = FOX_fonts;
+	for(; font; font = font->next) {
+		const FOX_FontFile *file = font->file;
+		if(font->state != FOX_FONT_FAILED && font->renderer == renderer
+			&& font->size.ptsize == size
+			&& font->flags == flags && font->index == index
+			&& font->atlas_budget == budget
+			&& (path ? file->path && SDL_strcmp(file->path, path) == 0
+					: !file->path && !file->src && file->data == data)
+		) {
+			font->refcount++;
+			break;
+		}
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	return font;
+}
+
+static void FOX_RegisterFont(FOX_SharedFont *font) {
+	SDL_LockMutex(FOX_registry_lock);
+	font->refcount = 1;
+	font->next = FOX_fonts;
+	FOX_fonts = font;
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+/* Takes another reference to an open font. */
+static void FOX_RetainFont(FOX_SharedFont *font) {
+	SDL_LockMutex(FOX_registry_lock);
+	font->refcount++;
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+/* Drops a reference to a font. Returns SDL_TRUE if it was the last one and
+ * the font has been removed from the registry. */
+static SDL_bool FOX_UnregisterFont(FOX_SharedFont *font) {
+	SDL_LockMutex(FOX_registry_lock);
+	SDL_bool last = --font->refcount <= 0;
+	if(last) {
+		for(FOX_SharedFont **link = &FOX_fonts; *link; link = &(*link)->next) {
+			if(*link == font) {
+				*link = font->next;
+				break;
+			}
+		}
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	return last;
+}
+
+/* Returns the number of handles and fallback chains using a font. */
+static int FOX_CountUsers(FOX_SharedFont *font) {
+	SDL_LockMutex(FOX_registry_lock);
+	int users = font->refcount;
+	SDL_UnlockMutex(FOX_registry_lock);
+	return users;
+}
+
+/* Points a handle to a font and adds it to the handles of the font, which
+ * do not hold references of their own. */
+static void FOX_AttachHandle(FOX_Font *font, FOX_SharedFont *shared) {
+	SDL_LockMutex(FOX_registry_lock);
+	font->shared = shared;
+	font->next = shared->handles;
+	shared->handles = font;
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+static void FOX_DetachHandle(FOX_Font *font) {
+	SDL_LockMutex(FOX_registry_lock);
+	for(FOX_Font **link = &font->shared->handles; *link;
+								link = &(*link)->next
+	) {
+		if(*link == font) {
+			*link = font->next;
+			break;
+		}
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+/* Maps a font file, or takes another reference if it is mapped already. */
+static FOX_FontFile* FOX_AcquireFontFile(const char *path) {
+	SDL_LockMutex(FOX_registry_lock);
+	FOX_FontFile *file = FOX_files;
+	for(; file; file = file->next) {
+		if(SDL_strcmp(file->path, path) == 0) {
+			file->refcount++;
+			goto done;
+		}
+	}
+
+	file = SDL_calloc(1, sizeof(*file));
+	if(!file) goto done;
+	file->path = SDL_strdup(path);
+	if(file->path) file->data = FOX_MapFile(path, &file->size);
+	if(!file->data) {
+		SDL_free(file->path);
+		SDL_free(file);
+		file = NULL;
+		goto done;
+	}
+	file->refcount = 1;
+	file->next = FOX_files;
+	FOX_files = file;
+
+	done:
+		SDL_UnlockMutex(FOX_registry_lock);
+		return file;
+}
+
+/* Wraps memory of the application holding a font, without copying it. */
+static FOX_FontFile* FOX_WrapFontMem(const void *data, size_t size) {
+	if(!data || size == 0) {
+		SDL_SetError("No font data");
+		return NULL;
+	}
+
+	FOX_FontFile *file = SDL_calloc(1, sizeof(*file));
+	if(!file) return NULL;
+	file->data = (void*)data;
+	file->size = size;
+	file->refcount = 1;
+	return file;
+}
+
+/* Reads from the stream of a font for freetype. A count of 0 only seeks
+ * and returns 0 on success. */
+static unsigned long FOX_ReadStream(FT_Stream stream, unsigned long offset,
+							unsigned char *buffer, unsigned long count
+) {
+	FOX_FontFile *file = stream->descriptor.pointer;
+	if(SDL_RWseek(file->src, file->offset + offset, RW_SEEK_SET) < 0) {
+		return count ? 0 : 1;
+	}
+	if(count == 0) return 0;
+	return (unsigned long)SDL_RWread(file->src, buffer, 1, count);
+}
+
+/* Wraps a stream holding a font from its current position on. The stream
+ * is closed right away on error if freesrc is set. */
+static FOX_FontFile* FOX_WrapFontRW(SDL_RWops *src, int freesrc) {
+	if(!src) return NULL;
+
+	Sint64 offset = SDL_RWtell(src);
+	Sint64 size = SDL_RWsize(src);
+	FOX_FontFile *file = NULL;
+	if(offset < 0 || size <= offset) {
+		SDL_SetError("Font stream must be seekable and of known size");
+	} else {
+		file = SDL_calloc(1, sizeof(*file));
+	}
+	if(!file) {
+		if(freesrc) SDL_RWclose(src);
+		return NULL;
+	}
+
+	file->src = src;
+	file->freesrc = freesrc != 0;
+	file->offset = offset;
+	file->size = (size_t)(size - offset);
+	file->stream.size = (unsigned long)file->size;
+	file->stream.descriptor.pointer = file;
+	file->stream.read = FOX_ReadStream;
+	file->refcount = 1;
+	return file;
+}
+
+/* Opens a face of a font file with freetype. Faces are created and freed
+ * under the registry lock, as fonts may be loaded by several threads. */
+static FT_Error FOX_OpenFace(FOX_FontFile *file, int index, FT_Face *face) {
+	FT_Open_Args args;
+	SDL_zero(args);
+	if(file->data) {
+		args.flags = FT_OPEN_MEMORY;
+		args.memory_base = file->data;
+		args.memory_size = (FT_Long)file->size;
+	} else {
+		args.flags = FT_OPEN_STREAM;
+		args.stream = &file->stream;
+	}
+
+	SDL_LockMutex(FOX_registry_lock);
+	FT_Error error = FT_Open_Face(libfreetype, &args, index, face);
+	SDL_UnlockMutex(FOX_registry_lock);
+	return error;
+}
+
+static void FOX_CloseFace(FT_Face face) {
+	if(!face) return;
+	SDL_LockMutex(FOX_registry_lock);
+	FT_Done_Face(face);
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+static void FOX_FreeFontFile(FOX_FontFile *file) {
+	if(file->path) {
+		FOX_UnmapFile(file->data, file->size);
+		SDL_free(file->path);
+	}
+	if(file->freesrc) SDL_RWclose(file->src);
+	SDL_free(file);
+}
+
+static void FOX_ReleaseFontFile(FOX_FontFile *file) {
+	SDL_LockMutex(FOX_registry_lock);
+	SDL_bool last = --file->refcount <= 0;
+	if(last) {
+		for(FOX_FontFile **link = &FOX_files; *link; link = &(*link)->next) {
+			if(*link == file) {
+				*link = file->next;
+				break;
+			}
+		}
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	if(last) FOX_FreeFontFile(file);
+}
+
+/* Frees all fonts that are still open along with their handles, stopping
+ * their loaders, before the freetype library goes. Their files, whether
+ * mapped, in memory or streamed, go along with the last font using them.
+ * Fonts only held by fallback chains are in the registry as well. */
+static void FOX_ClearRegistry(void) {
+	while(FOX_fonts) {
+		FOX_SharedFont *font = FOX_fonts;
+		FOX_fonts = font->next;
+		while(font->handles) {
+			FOX_Font *handle = font->handles;
+			font->handles = handle->next;
+			FOX_FreeFallbackMap(handle);
+			SDL_free(handle->fallbacks);
+			SDL_free(handle);
+		}
+		FOX_FreeFont(font);
+	}
+}
+
+/******************************************************************************
+ * Glyph atlas
+ *****************************************************************************/
+
+/* Gap in pixels between packed glyphs, so that texture filtering never
+ * samples neighbouring glyphs. */
+#define FOX_ATLAS_PADDING 1
+
+/* Returns the maximum texture side length supported by the renderer. */
+static int FOX_MaxTextureSize(SDL_Renderer *renderer) {
+	SDL_RendererInfo info;
+	int size = 4096;
+	if(renderer && SDL_GetRendererInfo(renderer, &info) == 0) {
+		int max = SDL_min(info.max_texture_width, info.max_texture_height);
+		if(max > 0) size = max;
+	}
+	return size;
+}
+
+/* Estimates the side length of an atlas page. A static atlas starts out
+ * as a square fitting all glyphs and grows in height if the estimate was
+ * too small. A dynamic atlas uses fixed pages for about 256 glyphs. */
+static int FOX_ChoosePageSize(FOX_SharedFont *font) {
+	int glyphs = font->face->num_glyphs;
+	if(font->flags & FOX_OPEN_DYNAMIC) glyphs = SDL_min(glyphs, 256);
+
+	/* Most glyphs occupy well below the full em square */
+	int cell = font->size.ptsize * 3 / 4 + FOX_ATLAS_PADDING;
+	int size = (int)SDL_ceil(SDL_sqrt(glyphs) * cell);
+	size = SDL_max(size, 2 * (font->size.ptsize + FOX_ATLAS_PADDING));
+	size = (size + 63) & ~63;
+
+	return SDL_min(size, font->max_texture_size);
+}
+
+static void FOX_FreePage(FOX_AtlasPage *page) {
+	SDL_DestroyTexture(page->texture);
+	SDL_FreeSurface(page->surface);
+	SDL_free(page->coverage);
+	SDL_free(page->skyline);
+	SDL_free(page->batch.vertices);
+	SDL_free(page->batch.indices);
+	SDL_free(page->glyphs);
+}
+
+static void FOX_FreePages(FOX_SharedFont *font) {
+	for(int i = 0; i < font->num_pages; i++) {
+		FOX_FreePage(&font->pages[i]);
+	}
+	SDL_free(font->pages);
+	font->pages = NULL;
+	font->num_pages = 0;
+}
+
+/* Creates an empty page of the given size. Pages of a static atlas are
+ * kept as surfaces until all glyphs have been rasterized, pages of
+ * a dynamic atlas are textures updated glyph by glyph. Pages of surface
+ * fonts only consist of coverage values.
+ * Returns the page index or -1 on error. */
+static int FOX_AddPage(FOX_SharedFont *font, int w, int h) {
+	if(font->num_pages == 0xFFFF) return -1;
+
+	FOX_AtlasPage *pages = SDL_realloc(font->pages,
+								sizeof(*pages) * (font->num_pages + 1));
+	if(!pages) return -1;
+	font->pages = pages;
+
+	FOX_AtlasPage *page = &pages[font->num_pages];
+	SDL_zerop(page);
+	page->w = w;
+	page->h = h;
+	page->last_used = ++font->clock;
+
+	/* The skyline consists of at most one node per pixel column */
+	page->skyline = SDL_malloc(sizeof(*page->skyline) * (w + 1));
+	if(!page->skyline) return -1;
+	page->skyline[0] = (FOX_SkylineNode){0, 0, w};
+	page->nodes = 1;
+
+	if(font->flags & FOX_OPEN_SURFACE) {
+		page->coverage = SDL_calloc((size_t)w * h, sizeof(Uint8));
+		if(!page->coverage) goto abort;
+		return font->num_pages++;
+	}
+
+	if(!(font->flags & FOX_OPEN_DYNAMIC)) {
+		page->surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32,
+													SDL_PIXELFORMAT_RGBA32);
+		if(!page->surface) goto abort;
+		return font->num_pages++;
+	}
+
+	page->texture = SDL_CreateTexture(font->renderer, SDL_PIXELFORMAT_RGBA32,
+										SDL_TEXTUREACCESS_STATIC, w, h);
+	if(!page->texture) goto abort;
+	SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+
+	/* Texture contents are undefined after creation, so clear the page
+	 * in strips of 64 rows. */
+	void *zero = SDL_calloc(w * 64, sizeof(Uint32));
+	if(!zero) {
+		SDL_DestroyTexture(page->texture);
+		goto abort;
+	}
+	for(int y = 0; y < h; y += 64) {
+		SDL_Rect rect = {0, y, w, SDL_min(64, h - y)};
+		SDL_UpdateTexture(page->texture, &rect, zero, w * sizeof(Uint32));
+	}
+	SDL_free(zero);
+
+	return font->num_pages++;
+
+	abort:
+		SDL_free(page->skyline);
+		return -1;
+}
+
+/* Doubles the height of a static atlas page, up to the given maximum. */
+static SDL_bool FOX_GrowPage(FOX_AtlasPage *page, int max) {
+	int h = SDL_min(page->h * 2, max);
+	if(h <= page->h || (!page->surface && !page->coverage)) return SDL_FALSE;
+
+	if(page->coverage) {
+		Uint8 *coverage = SDL_realloc(page->coverage, (size_t)page->w * h);
+		if(!coverage) return SDL_FALSE;
+		SDL_memset(coverage + (size_t)page->w * page->h, 0,
+							(size_t)page->w * (h - page->h));
+		page->coverage = coverage;
+		page->h = h;
+		return SDL_TRUE;
+	}
+
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, page->w, h,
+												32, SDL_PIXELFORMAT_RGBA32);
+	if(!surface) return SDL_FALSE;
+	for(int y = 0; y < page->h; y++) {
+		SDL_memcpy((Uint8*)surface->pixels + y * surface->pitch,
+					(Uint8*)page->surface->pixels + y * page->surface->pitch,
+					page->w * sizeof(Uint32));
+	}
+
+	SDL_FreeSurface(page->surface);
+	page->surface = surface;
+	page->h = h;
+	return SDL_TRUE;
+}
+
+/* Returns the height at which a w * h rect rests when its left edge is
+ * placed at skyline node i, or -1 if it does not fit onto the page. */
+static int FOX_SkylineFit(const FOX_AtlasPage *page, int i, int w, int h) {
+	if(page->skyline[i].x + w > page->w) return -1;
+
+	int y = 0;
+	for(int remaining = w; remaining > 0; i++) {
+		y = SDL_max(y, page->skyline[i].y);
+		if(y + h > page->h) return -1;
+		remaining -= page->skyline[i].w;
+	}
+	return y;
+}
+
+/* Reserves a w * h rect on the page using the bottom-left heuristic. */
+static SDL_bool FOX_SkylinePack(FOX_AtlasPage *page, int w, int h,
+														SDL_Point *pos
+) {
+	FOX_SkylineNode *skyline = page->skyline;
+	int best = -1, best_y = 0, best_w = 0;
+
+	for(int i = 0; i < page->nodes; i++) {
+		int y = FOX_SkylineFit(page, i, w, h);
+		if(y < 0) continue;
+		if(best < 0 || y < best_y || (y == best_y && skyline[i].w < best_w)) {
+			best = i;
+			best_y = y;
+			best_w = skyline[i].w;
+		}
+	}
+	if(best < 0) return SDL_FALSE;
+
+	pos->x = skyline[best].x;
+	pos->y = best_y;
+
+	/* Insert the top edge of the rect as a new node */
+	SDL_memmove(&skyline[best + 1], &skyline[best],
+				sizeof(*skyline) * (page->nodes - best));
+	skyline[best] = (FOX_SkylineNode){pos->x, best_y + h, w};
+	page->nodes++;
+
+	/* Cut away the part of the following nodes now covered by the rect */
+	for(int i = best + 1; i < page->nodes;) {
+		FOX_SkylineNode *previous = &skyline[i - 1];
+		int overlap = previous->x + previous->w - skyline[i].x;
+		if(overlap <= 0) break;
+
+		skyline[i].x += overlap;
+		skyline[i].w -= overlap;
+		if(skyline[i].w > 0) break;
+
+		SDL_memmove(&skyline[i], &skyline[i + 1],
+					sizeof(*skyline) * (page->nodes - i - 1));
+		page->nodes--;
+	}
+
+	/* Merge neighbouring nodes of the same height */
+	for(int i = 0; i < page->nodes - 1;) {
+		if(skyline[i].y == skyline[i + 1].y) {
+			skyline[i].w += skyline[i + 1].w;
+			SDL_memmove(&skyline[i + 1], &skyline[i + 2],
+						sizeof(*skyline) * (page->nodes - i - 2));
+			page->nodes--;
+		} else i++;
+	}
+
+	page->used += w * h;
+	return SDL_TRUE;
+}
+
+/* Remembers a glyph placed on a page of a dynamic atlas, so that it can
+ * be evicted along with the page. */
+static SDL_bool FOX_TrackGlyph(FOX_AtlasPage *page, FT_UInt index) {
+	if(page->num_glyphs == page->glyph_capacity) {
+		int capacity = page->glyph_capacity ? page->glyph_capacity * 2 : 64;
+		FT_UInt *glyphs = SDL_realloc(page->glyphs,
+										sizeof(*glyphs) * capacity);
+		if(!glyphs) return SDL_FALSE;
+		page->glyphs = glyphs;
+		page->glyph_capacity = capacity;
+	}
+	page->glyphs[page->num_glyphs++] = index;
+	return SDL_TRUE;
+}
+
+/* Evicts the glyphs of a page of a dynamic atlas and empties the page for
+ * new glyphs. The texture keeps its pixels, as every glyph uploaded
+ * clears its surroundings, see FOX_UploadGlyph(). Evicted glyphs are
+ * rasterized again once they are needed. */
+static void FOX_EvictPage(FOX_SharedFont *font, FOX_AtlasPage *page) {
+	for(int i = 0; i < page->num_glyphs; i++) {
+		font->glyphs[page->glyphs[i]].state = FOX_GLYPH_EMPTY;
+	}
+	FOX_COUNT(font, glyphs_evicted, page->num_glyphs);
+	page->num_glyphs = 0;
+	page->skyline[0] = (FOX_SkylineNode){0, 0, page->w};
+	page->nodes = 1;
+	page->used = 0;
+	font->evictions++;
+}
+
+/* Returns whether a page may be evicted. Pages with queued quads and
+ * pinned pages are still in use. */
+static SDL_bool FOX_CanEvict(const FOX_SharedFont *font,
+										const FOX_AtlasPage *page
+) {
+	return page->batch.count == 0
+		&& (!font->pinned || page->last_used < font->pinned);
+}
+
+/* Frees the most recent pages of a dynamic atlas exceeding its budget,
+ * unless they are still in use. */
+static void FOX_ShrinkAtlas(FOX_SharedFont *font) {
+	while(font->max_pages > 0 && font->num_pages > font->max_pages) {
+		FOX_AtlasPage *page = &font->pages[font->num_pages - 1];
+		if(!FOX_CanEvict(font, page)) break;
+		FOX_EvictPage(font, page);
+		FOX_FreePage(page);
+		font->num_pages--;
+	}
+}
+
+/* Returns the page of a dynamic atlas used least recently that may be
+ * evicted, or -1 if all of them are in use. */
+static int FOX_LeastRecentPage(FOX_SharedFont *font) {
+	int victim = -1;
+	for(int i = 0; i < font->num_pages; i++) {
+		const FOX_AtlasPage *page = &font->pages[i];
+		if(FOX_CanEvict(font, page) && (victim < 0
+			|| page->last_used < font->pages[victim].last_used)
+		) {
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+/* Reserves atlas space for a w * h glyph bitmap (plus padding).
+ * Opens a new page once the existing ones are full. A dynamic atlas at
+ * its budget evicts the page used least recently instead, or exceeds the
+ * budget if all pages are in use. Pages beyond the budget are freed as
+ * soon as they are no longer in use.
+ * Returns the page index or -1 if the glyph does not fit. */
+static int FOX_AllocateGlyph(FOX_SharedFont *font, int w, int h,
+														SDL_Point *pos
+) {
+	w += FOX_ATLAS_PADDING;
+	h += FOX_ATLAS_PADDING;
+
+	/* Pages of a dynamic atlas never grow, so a glyph larger than a page
+	 * fits nowhere, and no page must be evicted for it */
+	if(font->flags & FOX_OPEN_DYNAMIC
+		&& (w > font->page_size || h > font->page_size)
+	) {
+		SDL_SetError("Glyph of %dx%d exceeds the atlas page size %d",
+						w, h, font->page_size);
+		return -1;
+	}
+
+	FOX_ShrinkAtlas(font);
+	for(int i = 0; i < font->num_pages; i++) {
+		if(FOX_SkylinePack(&font->pages[i], w, h, pos)) return i;
+	}
+
+	if(font->max_pages > 0 && font->num_pages >= font->max_pages) {
+		int i = FOX_LeastRecentPage(font);
+		if(i >= 0) {
+			FOX_EvictPage(font, &font->pages[i]);
+			return FOX_SkylinePack(&font->pages[i], w, h, pos) ? i : -1;
+		}
+	}
+
+	/* The most recent page of a static atlas grows before opening a new one */
+	if(font->num_pages > 0 && !(font->flags & FOX_OPEN_DYNAMIC)) {
+		FOX_AtlasPage *page = &font->pages[font->num_pages - 1];
+		while(FOX_GrowPage(page, font->max_texture_size)) {
+			if(FOX_SkylinePack(page, w, h, pos)) return font->num_pages - 1;
+		}
+	}
+
+	int size = font->page_size;
+	int i = FOX_AddPage(font, size, size);
+	if(i < 0) return -1;
+	if(FOX_SkylinePack(&font->pages[i], w, h, pos)) return i;
+	return -1;
+}
+
+/* Shrinks the pages of a static atlas to the area actually covered by
+ * glyphs. The surfaces keep their size. Coverage pages are drawn from
+ * directly and keep w as their pitch, so they are left alone. */
+static void FOX_TrimPages(FOX_SharedFont *font) {
+	for(int i = 0; i < font->num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		if(page->coverage) continue;
+		int w = 1, h = 1;
+		for(int n = 0; n < page->nodes; n++) {
+			FOX_SkylineNode *node = &page->skyline[n];
+			if(node->y > 0) w = SDL_max(w, node->x + node->w);
+			h = SDL_max(h, node->y);
+		}
+		page->w = SDL_min(w, page->w);
+		page->h = SDL_min(h, page->h);
+	}
+}
+
+/* Creates the texture of a page from pixels covering the whole page. */
+static SDL_bool FOX_CreatePageTexture(FOX_SharedFont *font, FOX_AtlasPage *page,
+										const void *pixels, int pitch
+) {
+	page->texture = SDL_CreateTexture(font->renderer, SDL_PIXELFORMAT_RGBA32,
+							SDL_TEXTUREACCESS_STATIC, page->w, page->h);
+	if(!page->texture) return SDL_FALSE;
+	SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+
+	SDL_Rect rect = {0, 0, page->w, page->h};
+	SDL_UpdateTexture(page->texture, &rect, pixels, pitch);
+	return SDL_TRUE;
+}
+
+/* Uploads the trimmed pages of a static atlas. */
+static SDL_bool FOX_UploadPages(FOX_SharedFont *font) {
+	for(int i = 0; i < font->num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		if(page->coverage) continue;
+		if(!FOX_CreatePageTexture(font, page, page->surface->pixels,
+											page->surface->pitch)
+		) {
+			return SDL_FALSE;
+		}
+		SDL_FreeSurface(page->surface);
+		page->surface = NULL;
+	}
+
+	return SDL_TRUE;
+}
+
+/* Sets the metrics of a glyph from the glyph slot it was rendered into.
+ * The bitmap rather than the outline metrics decides the atlas rect,
+ * so that no pixels are cut off or taken from neighbouring glyphs.
+ * Returns SDL_FALSE if the bitmap is not supported. */
+static SDL_bool FOX_SetGlyphMetrics(FOX_Glyph *glyph, FT_GlyphSlot slot) {
+	int width, rows;
+	if(!FOX_BitmapSize(&slot->bitmap, &width, &rows)) {
+		return SDL_FALSE;
+	}
+
+	FOX_GlyphMetrics *metrics = &glyph->metrics;
+	metrics->rect.w = width;
+	metrics->rect.h = rows;
+	metrics->bearing.x = slot->bitmap_left;
+	metrics->bearing.y = slot->bitmap_top;
+	metrics->advance = slot->metrics.horiAdvance >> 6;
+	return SDL_TRUE;
+}
+
+/* Reserves the atlas rect of a glyph whose metrics have been set and
+ * accounts for it in the font metrics. */
+static SDL_bool FOX_PlaceGlyph(FOX_SharedFont *font, FOX_Glyph *glyph) {
+	FOX_GlyphMetrics *metrics = &glyph->metrics;
+	if(metrics->rect.w > 0 && metrics->rect.h > 0) {
+		SDL_Point pos;
+		int page = FOX_AllocateGlyph(font, metrics->rect.w,
+										metrics->rect.h, &pos);
+		if(page < 0) return SDL_FALSE;
+		if(font->flags & FOX_OPEN_DYNAMIC
+			&& !FOX_TrackGlyph(&font->pages[page], glyph - font->glyphs)
+		) {
+			return SDL_FALSE;
+		}
+		glyph->page = page;
+		metrics->rect.x = pos.x;
+		metrics->rect.y = pos.y;
+	}
+
+	if(font->size.max_width < metrics->rect.w) {
+		font->size.max_width = metrics->rect.w;
+	}
+	if(font->size.max_height < metrics->rect.h) {
+		font->size.max_height = metrics->rect.h;
+	}
+	if(font->size.max_advance < metrics->advance) {
+		font->size.max_advance = metrics->advance;
+	}
+	return SDL_TRUE;
+}
+
+/* Copies the bitmap of a placed glyph into a static or coverage atlas page. */
+static void FOX_WriteGlyph(FOX_SharedFont *font, const FOX_Glyph *glyph,
+											const FT_Bitmap *bitmap
+) {
+	const SDL_Rect *rect = &glyph->metrics.rect;
+	FOX_AtlasPage *page = &font->pages[glyph->page];
+	if(page->coverage) {
+		FOX_CoverBitmap(bitmap, page->coverage + rect->y * page->w + rect->x,
+																page->w);
+		return;
+	}
+
+	SDL_Surface *surface = page->surface;
+	Uint8 *pixels = (Uint8*)surface->pixels + rect->y * surface->pitch;
+	FOX_BlitBitmap(bitmap, (Uint32*)pixels + rect->x, surface->pitch);
+}
+
+/* Uploads the bitmap of a placed glyph to a dynamic atlas page through
+ * the scratch surface. A border of one pixel around the glyph is cleared
+ * along with it, so that pixels left behind by evicted glyphs never end
+ * up next to it. With at least one pixel of padding between glyphs, the
+ * border only covers padding and unused space. */
+static SDL_bool FOX_UploadGlyph(FOX_SharedFont *font, const FOX_Glyph *glyph,
+											const FT_Bitmap *bitmap
+) {
+	const SDL_Rect *rect = &glyph->metrics.rect;
+	const FOX_AtlasPage *page = &font->pages[glyph->page];
+	SDL_Rect border;
+	border.x = SDL_max(rect->x - 1, 0);
+	border.y = SDL_max(rect->y - 1, 0);
+	border.w = SDL_min(rect->x + rect->w + 1, page->w) - border.x;
+	border.h = SDL_min(rect->y + rect->h + 1, page->h) - border.y;
+
+	SDL_Surface *scratch = font->scratch;
+	if(!scratch || scratch->w < border.w || scratch->h < border.h) {
+		SDL_FreeSurface(font->scratch);
+		font->scratch = SDL_CreateRGBSurfaceWithFormat(0,
+							SDL_max(border.w, font->size.ptsize),
+							SDL_max(border.h, font->size.ptsize),
+							32, SDL_PIXELFORMAT_RGBA32);
+		if(!font->scratch) return SDL_FALSE;
+		scratch = font->scratch;
+	}
+
+	for(int y = 0; y < border.h; y++) {
+		SDL_memset((Uint8*)scratch->pixels + y * scratch->pitch, 0,
+									border.w * sizeof(Uint32));
+	}
+	Uint8 *pixels = (Uint8*)scratch->pixels
+					+ (rect->y - border.y) * scratch->pitch;
+	FOX_BlitBitmap(bitmap, (Uint32*)pixels + (rect->x - border.x),
+													scratch->pitch);
+	SDL_UpdateTexture(page->texture, &border, scratch->pixels,
+												scratch->pitch);
+	return SDL_TRUE;
+}
+
+/* Rasterizes a glyph, places it in the atlas and sets its metrics. */
+static SDL_bool FOX_LoadGlyph(FOX_SharedFont *font, FT_UInt index) {
+	FOX_Glyph *glyph = &font->glyphs[index];
+	glyph->state = FOX_GLYPH_FAILED;
+
+	if(FT_Load_Glyph(font->face, index, FT_LOAD_RENDER)) {
+		return SDL_FALSE;
+	}
+
+	FT_GlyphSlot slot = font->face->glyph;
+	if(!FOX_SetGlyphMetrics(glyph, slot) || !FOX_PlaceGlyph(font, glyph)) {
+		return SDL_FALSE;
+	}
+
+	if(glyph->metrics.rect.w > 0 && glyph->metrics.rect.h > 0) {
+		FOX_AtlasPage *page = &font->pages[glyph->page];
+		if(page->surface || page->coverage) {
+			FOX_WriteGlyph(font, glyph, &slot->bitmap);
+		} else if(!FOX_UploadGlyph(font, glyph, &slot->bitmap)) {
+			return SDL_FALSE;
+		}
+	}
+
+	glyph->state = FOX_GLYPH_LOADED;
+	FOX_COUNT(font, glyphs_rasterized, 1);
+	return SDL_TRUE;
+}
+
+/* Rasterizes every glyph reachable through the character map. */
+static SDL_bool FOX_RenderFontToPages(FOX_SharedFont *font) {
+	int size = font->page_size;
+	if(FOX_AddPage(font, size, size) < 0) return SDL_FALSE;
+
+	FT_UInt index;
+	for(FT_ULong charcode = FT_Get_First_Char(font->face, &index);
+		index != 0;
+		charcode = FT_Get_Next_Char(font->face, charcode, &index)
+	) {
+		if(SDL_AtomicGet(&font->cancel)) return SDL_FALSE;
+		if(font->glyphs[index].state == FOX_GLYPH_EMPTY) {
+			FOX_LoadGlyph(font, index);
+		}
+	}
+
+	return SDL_TRUE;
+}
+
+/******************************************************************************
+ * Parallel atlas rasterization
+ *****************************************************************************/
+
+/* Upper bound of threads rasterizing a single font */
+#define FOX_MAX_WORKERS 64
+
+/* Number of glyphs a worker claims at once */
+#define FOX_WORKER_CHUNK 32
+
+/* A glyph rasterized by a worker, waiting to be placed and copied */
+typedef struct {
+	FT_UInt index;
+	FT_Bitmap bitmap;	/* buffer is resolved once all workers are done */
+	size_t offset;		/* of the bitmap buffer inside the worker arena */
+	int worker;
+} FOX_RasterJob;
+
+typedef struct FOX_Raster FOX_Raster;
+
+typedef struct {
+	FOX_Raster *raster;
+	FT_Face face;		/* private face on the shared font data */
+	Uint8 *arena;		/* copies of the rendered bitmaps */
+	size_t used;
+	size_t capacity;
+	int id;
+} FOX_Worker;
+
+struct FOX_Raster {
+	FOX_SharedFont *font;
+	FOX_RasterJob *jobs;	/* one per glyph, in character map order */
+	int num_jobs;
+	SDL_atomic_t next;		/* first job not claimed by any worker */
+	FOX_Worker workers[FOX_MAX_WORKERS];
+	int num_workers;
+};
+
+/* Claims the next chunk of jobs. Returns SDL_FALSE if all are done or
+ * loading the font has been cancelled. */
+static SDL_bool FOX_ClaimJobs(FOX_Raster *raster, int *first, int *last) {
+	if(SDL_AtomicGet(&raster->font->cancel)) return SDL_FALSE;
+	*first = SDL_AtomicAdd(&raster->next, FOX_WORKER_CHUNK);
+	*last = SDL_min(*first + FOX_WORKER_CHUNK, raster->num_jobs);
+	return *first < raster->num_jobs;
+}
+
+/* Phase 1: rasterizes glyphs with the face of the worker and keeps
+ * a copy of each bitmap. Only the glyph slots of claimed jobs are written. */
+static int SDLCALL FOX_RasterizeWorker(void *data) {
+	FOX_Worker *worker = data;
+	FOX_Raster *raster = worker->raster;
+	FOX_SharedFont *font = raster->font;
+
+	int first, last;
+	while(FOX_ClaimJobs(raster, &first, &last)) {
+		for(int i = first; i < last; i++) {
+			FOX_RasterJob *job = &raster->jobs[i];
+			FOX_Glyph *glyph = &font->glyphs[job->index];
+			FT_GlyphSlot slot = worker->face->glyph;
+
+			if(FT_Load_Glyph(worker->face, job->index, FT_LOAD_RENDER)
+				|| !FOX_SetGlyphMetrics(glyph, slot)
+			) {
+				glyph->state = FOX_GLYPH_FAILED;
+				continue;
+			}
+
+			size_t size = slot->bitmap.rows * (size_t)SDL_abs(slot->bitmap.pitch);
+			if(worker->used + size > worker->capacity) {
+				size_t capacity = SDL_max(worker->capacity * 2,
+										worker->used + size + 65536);
+				Uint8 *arena = SDL_realloc(worker->arena, capacity);
+				if(!arena) {
+					glyph->state = FOX_GLYPH_FAILED;
+					continue;
+				}
+				worker->arena = arena;
+				worker->capacity = capacity;
+			}
+
+			SDL_memcpy(worker->arena + worker->used, slot->bitmap.buffer, size);
+			job->bitmap = slot->bitmap;
+			job->bitmap.buffer = NULL;
+			job->offset = worker->used;
+			job->worker = worker->id;
+			worker->used += size;
+		}
+	}
+
+	return 0;
+}
+
+/* Phase 3: copies the bitmaps into their (disjoint) atlas rects. */
+static int SDLCALL FOX_BlitWorker(void *data) {
+	FOX_Worker *worker = data;
+	FOX_Raster *raster = worker->raster;
+	FOX_SharedFont *font = raster->font;
+
+	int first, last;
+	while(FOX_ClaimJobs(raster, &first, &last)) {
+		for(int i = first; i < last; i++) {
+			FOX_RasterJob *job = &raster->jobs[i];
+			FOX_Glyph *glyph = &font->glyphs[job->index];
+			if(glyph->state == FOX_GLYPH_LOADED && job->bitmap.buffer) {
+				FOX_WriteGlyph(font, glyph, &job->bitmap);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Runs a phase on all workers. The calling thread acts as worker 0. */
+static void FOX_RunWorkers(FOX_Raster *raster, SDL_ThreadFunction function) {
+	SDL_Thread *threads[FOX_MAX_WORKERS] = {NULL};
+
+	SDL_AtomicSet(&raster->next, 0);
+	for(int i = 1; i < raster->num_workers; i++) {
+		threads[i] = SDL_CreateThread(function, "FOX_Worker",
+										&raster->workers[i]);
+	}
+
+	function(&raster->workers[0]);
+
+	for(int i = 1; i < raster->num_workers; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+}
+
+/* Rasterizes every glyph reachable through the character map using
+ * multiple threads, each with its own face on the shared font data.
+ * Glyphs are placed in character map order, so the resulting atlas is
+ * identical to that of FOX_RenderFontToPages(). */
+static SDL_bool FOX_RenderFontToPagesParallel(FOX_SharedFont *font) {
+	FOX_Raster *raster = SDL_calloc(1, sizeof(*raster));
+	if(!raster) return SDL_FALSE;
+	raster->font = font;
+	SDL_bool success = SDL_FALSE;
+
+	/* Collect the distinct glyphs of the character map */
+	raster->jobs = SDL_malloc(sizeof(*raster->jobs) * font->face->num_glyphs);
+	Uint8 *collected = SDL_calloc(font->face->num_glyphs, sizeof(Uint8));
+	if(!raster->jobs || !collected) {
+		SDL_free(collected);
+		goto cleanup;
+	}
+
+	FT_UInt index;
+	for(FT_ULong charcode = FT_Get_First_Char(font->face, &index);
+		index != 0;
+		charcode = FT_Get_Next_Char(font->face, charcode, &index)
+	) {
+		if(!collected[index]) {
+			collected[index] = 1;
+			raster->jobs[raster->num_jobs++].index = index;
+		}
+	}
+	SDL_free(collected);
+
+	/* Set up the workers; creating faces is not thread-safe, so all of
+	 * them are created on the calling thread. */
+	int count = SDL_min(SDL_GetCPUCount(), FOX_MAX_WORKERS);
+	count = SDL_max(1, SDL_min(count, raster->num_jobs / FOX_WORKER_CHUNK));
+	for(int i = 0; i < count; i++) {
+		FOX_Worker *worker = &raster->workers[i];
+		worker->raster = raster;
+		worker->id = i;
+		if(i == 0) {
+			worker->face = font->face;
+		} else if(FOX_OpenFace(font->file, font->face->face_index,
+														&worker->face)
+				|| FT_Set_Pixel_Sizes(worker->face, font->size.ptsize,
+												font->size.ptsize)
+		) {
+			FOX_CloseFace(worker->face);
+			worker->face = NULL;
+			break;
+		}
+		raster->num_workers++;
+	}
+
+	FOX_RunWorkers(raster, FOX_RasterizeWorker);
+	if(SDL_AtomicGet(&font->cancel)) goto cleanup;
+
+	/* Phase 2: place all glyphs on the calling thread */
+	int size = font->page_size;
+	if(FOX_AddPage(font, size, size) < 0) goto cleanup;
+	for(int i = 0; i < raster->num_jobs; i++) {
+		FOX_RasterJob *job = &raster->jobs[i];
+		FOX_Glyph *glyph = &font->glyphs[job->index];
+		if(glyph->state == FOX_GLYPH_FAILED) continue;
+		if(!FOX_PlaceGlyph(font, glyph)) {
+			glyph->state = FOX_GLYPH_FAILED;
+			continue;
+		}
+		if(job->bitmap.rows > 0) {
+			job->bitmap.buffer = raster->workers[job->worker].arena + job->offset;
+		}
+		glyph->state = FOX_GLYPH_LOADED;
+		FOX_COUNT(font, glyphs_rasterized, 1);
+	}
+
+	FOX_RunWorkers(raster, FOX_BlitWorker);
+	success = !SDL_AtomicGet(&font->cancel);
+
+	cleanup:
+		for(int i = 0; i < raster->num_workers; i++) {
+			FOX_Worker *worker = &raster->workers[i];
+			if(i > 0) FOX_CloseFace(worker->face);
+			SDL_free(worker->arena);
+		}
+		SDL_free(raster->jobs);
+		SDL_free(raster);
+		return success;
+}
+
+int FOX_PreloadGlyphs(FOX_Font *font, Uint32 first, Uint32 last) {
+	if(!FOX_FontReady(font)) return 0;
+	int count = 0;
+	for(Uint32 ch = first; ch <= last; ch++) {
+		if(FOX_QueryGlyphMetrics(font, ch)) count++;
+		if(ch == last) break; /* avoid wrapping around at 0xFFFFFFFF */
+	}
+	return count;
+}
+
+/* Bounds the atlas of a dynamic font to the given number of bytes, or
+ * lifts the bound if 0. */
+static void FOX_LimitAtlas(FOX_SharedFont *font, size_t bytes) {
+	/* Pages of a dynamic atlas all have the same size */
+	size_t page_bytes = (size_t)font->page_size * font->page_size
+			* (font->flags & FOX_OPEN_SURFACE ? sizeof(Uint8) : sizeof(Uint32));
+	size_t max_pages = bytes / page_bytes;
+	font->atlas_budget = bytes;
+	font->max_pages = bytes ? (int)SDL_clamp(max_pages, 1, 0xFFFF) : 0;
+	FOX_ShrinkAtlas(font);
+}
+
+SDL_bool FOX_SetAtlasBudget(FOX_Font *font, size_t bytes) {
+	FOX_SharedFont *shared = font->shared;
+	if(!(shared->flags & FOX_OPEN_DYNAMIC)) {
+		SDL_SetError("Font was not opened with FOX_OPEN_DYNAMIC");
+		return SDL_FALSE;
+	}
+	if(!FOX_FontReady(font)) {
+		SDL_SetError("Font has not finished loading");
+		return SDL_FALSE;
+	}
+	if(shared->atlas_budget == bytes) return SDL_TRUE;
+
+	/* Others using the atlas did not ask for the budget, so the handle
+	 * moves on to a font of its own. Streams cannot be opened twice;
+	 * they are only shared with fallback chains, which keep up. */
+	const FOX_FontFile *file = shared->file;
+	if(FOX_CountUsers(shared) > 1 && !file->src) {
+		FOX_SharedFont *own = FOX_ShareFont(shared->renderer, file->path,
+						file->data, file->size, shared->index,
+						shared->size.ptsize, shared->flags, bytes);
+		if(!own) return SDL_FALSE;
+		FOX_DetachHandle(font);
+		FOX_ReleaseFont(shared);
+		FOX_AttachHandle(font, own);
+		font->generation++;
+		return SDL_TRUE;
+	}
+
+	FOX_LimitAtlas(shared, bytes);
+	return SDL_TRUE;
+}
+
+void FOX_QueryAtlasInfo(FOX_Font *font, FOX_AtlasInfo *info) {
+	SDL_zerop(info);
+	if(!FOX_FontReady(font)) return;
+	const FOX_SharedFont *shared = font->shared;
+	info->pages = shared->num_pages;
+	for(int i = 0; i < shared->num_pages; i++) {
+		FOX_AtlasPage *page = &shared->pages[i];
+		info->used_pixels += page->used;
+		info->total_pixels += (size_t)page->w * page->h;
+		info->bytes += (size_t)page->w * page->h
+						* (page->coverage ? sizeof(Uint8) : sizeof(Uint32));
+	}
+	for(long i = 0; i < shared->face->num_glyphs; i++) {
+		if(shared->glyphs[i].state == FOX_GLYPH_LOADED) info->glyphs++;
+	}
+}
+
+SDL_bool FOX_GetFontStats(FOX_Font *font, FOX_FontStats *stats) {
+	SDL_zerop(stats);
+	if(!FOX_FontReady(font)) return SDL_FALSE;
+	FOX_QueryAtlasInfo(font, &stats->atlas);
+
+	#ifdef FOX_USE_STATS
+	const FOX_Stats *counters = &font->shared->stats;
+	double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	stats->glyphs_rendered = counters->glyphs_rendered;
+	stats->draw_calls = counters->draw_calls;
+	stats->glyph_hits = counters->glyph_hits;
+	stats->glyph_misses = counters->glyph_misses;
+	stats->glyphs_rasterized = counters->glyphs_rasterized;
+	stats->glyphs_evicted = counters->glyphs_evicted;
+	stats->kerning_lookups = counters->kerning_lookups;
+	stats->kerning_misses = counters->kerning_misses;
+	stats->lines_laid_out = counters->lines_laid_out;
+	stats->open_ms = counters->open_ticks * ms;
+	stats->rasterize_ms = counters->rasterize_ticks * ms;
+	stats->layout_ms = counters->layout_ticks * ms;
+	return SDL_TRUE;
+	#else
+	return SDL_FALSE;
+	#endif
+}
+
+void FOX_ResetFontStats(FOX_Font *font) {
+	#ifdef FOX_USE_STATS
+	if(FOX_FontReady(font)) SDL_zero(font->shared->stats);
+	#else
+	(void)font;
+	#endif
+}
+
+/******************************************************************************
+ * Atlas cache
+ *****************************************************************************/
+
+/* Bump whenever the cache file layout or the rasterization changes */
+#define FOX_CACHE_VERSION 2
+
+/* Describes the font a cached atlas was created from, followed by the
+ * path of the font file (zero-padded to a multiple of 8 bytes), the glyph
+ * array, the page array and the pixels of each page. */
+typedef struct {
+	char magic[8];			/* "FOXATLAS" */
+	Uint32 version;
+	Uint32 options;			/* build options affecting the atlas */
+	Uint32 freetype;		/* version of the freetype library */
+	Sint32 ptsize;
+	Sint32 face_index;
+	Sint64 mtime;			/* of the font file */
+	Uint64 filesize;
+	Sint32 num_glyphs;
+	Sint32 num_pages;
+	Uint32 path_length;
+	FOX_FontMetrics metrics;
+} FOX_CacheHeader;
+
+typedef struct {
+	Sint32 w, h;
+	Sint32 used;
+} FOX_CachePage;
+
+#define FOX_CACHE_OPTIONS ((Uint32)(FOX_ATLAS_PADDING \
+	| sizeof(FOX_Glyph) << 8 | (SDL_BYTEORDER == SDL_BIG_ENDIAN) << 16))
+
+#define FOX_CACHE_PATH_SIZE(length) (((size_t)(length) + 7) & ~(size_t)7)
+
+SDL_bool FOX_SetAtlasCacheDir(const char *path) {
+	char *dir = NULL;
+	if(path && !(dir = SDL_strdup(path))) return SDL_FALSE;
+	SDL_free(FOX_cache_dir);
+	FOX_cache_dir = dir;
+	return SDL_TRUE;
+}
+
+#define FOX_FNV_OFFSET 14695981039346656037ULL
+
+/* Continues a 64-bit FNV-1a hash over a block of bytes. */
+static Uint64 FOX_HashBytes(Uint64 hash, const void *data, size_t size) {
+	const Uint8 *bytes = data;
+	for(size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Returns the cache file for a face and size inside the cache directory
+ * or NULL if caching is disabled. The name is a hash of path, face index
+ * and size. */
+static char* FOX_AtlasCachePath(const char *path, int index, int size) {
+	if(!FOX_cache_dir) return NULL;
+
+	Uint64 hash = FOX_HashBytes(FOX_FNV_OFFSET, path, SDL_strlen(path));
+	hash = (hash ^ (Uint32)size) * 1099511628211ULL;
+	if(index != 0) hash = (hash ^ (Uint32)index) * 1099511628211ULL;
+
+	size_t length = SDL_strlen(FOX_cache_dir) + 32;
+	char *cache = SDL_malloc(length);
+	if(!cache) return NULL;
+	SDL_snprintf(cache, length, "%s/%08x%08x.atlas", FOX_cache_dir,
+				(Uint32)(hash >> 32), (Uint32)hash);
+	return cache;
+}
+
+/* Fills in the fields of a cache header identifying a font. */
+static SDL_bool FOX_InitCacheHeader(FOX_SharedFont *font, const char *path,
+												FOX_CacheHeader *header
+) {
+	struct stat info;
+	if(stat(path, &info) != 0) return SDL_FALSE;
+
+	FT_Int major, minor, patch;
+	FT_Library_Version(libfreetype, &major, &minor, &patch);
+
+	SDL_zerop(header);
+	SDL_memcpy(header->magic, "FOXATLAS", 8);
+	header->version = FOX_CACHE_VERSION;
+	header->options = FOX_CACHE_OPTIONS;
+	header->freetype = major * 10000 + minor * 100 + patch;
+	header->ptsize = font->size.ptsize;
+	header->face_index = font->face->face_index;
+	header->mtime = info.st_mtime;
+	header->filesize = info.st_size;
+	header->num_glyphs = font->face->num_glyphs;
+	header->path_length = SDL_strlen(path);
+	return SDL_TRUE;
+}
+
+/* Maps a file into memory for reading. Returns NULL on error. */
+static void* FOX_MapFile(const char *path, size_t *size) {
+	#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+							OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) return NULL;
+
+	void *data = NULL;
+	LARGE_INTEGER length;
+	if(GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY,
+															0, 0, NULL);
+		if(mapping) {
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			*size = (size_t)length.QuadPart;
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	return data;
+	#else
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return NULL;
+
+	void *data = NULL;
+	struct stat info;
+	if(fstat(fd, &info) == 0 && info.st_size > 0) {
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) data = NULL;
+		*size = info.st_size;
+	}
+	close(fd);
+	return data;
+	#endif
+}
+
+static void FOX_UnmapFile(void *data, size_t size) {
+	#ifdef _WIN32
+	UnmapViewOfFile(data);
+	#else
+	munmap(data, size);
+	#endif
+}
+
+/* Validates a mapped cache file against the font and, if it matches,
+ * creates the atlas textures straight from the mapped pixels. Unless
+ * upload is set, the pixels are copied into page surfaces instead. */
+static SDL_bool FOX_LoadCacheData(FOX_SharedFont *font, const char *path,
+						const Uint8 *data, size_t size, SDL_bool upload
+) {
+	FOX_CacheHeader expected, header;
+	if(size < sizeof(header)
+		|| !FOX_InitCacheHeader(font, path, &expected)
+	) {
+		return SDL_FALSE;
+	}
+
+	/* Compare everything but the font metrics */
+	SDL_memcpy(&header, data, sizeof(header));
+	expected.num_pages = header.num_pages;
+	expected.metrics = header.metrics;
+	if(SDL_memcmp(&header, &expected, sizeof(header)) != 0
+		|| header.num_pages <= 0 || header.num_pages > 0xFFFF
+	) {
+		return SDL_FALSE;
+	}
+
+	size_t glyphs_size = sizeof(FOX_Glyph) * header.num_glyphs;
+	size_t pages_size = sizeof(FOX_CachePage) * header.num_pages;
+	size_t offset = sizeof(header) + FOX_CACHE_PATH_SIZE(header.path_length);
+	if(size < offset + glyphs_size + pages_size
+		|| SDL_memcmp(&data[sizeof(header)], path, header.path_length) != 0
+	) {
+		return SDL_FALSE;
+	}
+
+	const FOX_Glyph *glyphs = (const FOX_Glyph*)&data[offset];
+	const FOX_CachePage *pages =
+				(const FOX_CachePage*)&data[offset + glyphs_size];
+	const Uint8 *pixels = &data[offset + glyphs_size + pages_size];
+
+	/* Make sure that no page or glyph points outside of the file */
+	int max_size = font->max_texture_size;
+	size_t pixels_size = 0;
+	for(int i = 0; i < header.num_pages; i++) {
+		if(pages[i].w <= 0 || pages[i].w > max_size
+			|| pages[i].h <= 0 || pages[i].h > max_size
+		) {
+			return SDL_FALSE;
+		}
+		pixels_size += (size_t)pages[i].w * pages[i].h * sizeof(Uint32);
+	}
+	if(size - (pixels - data) < pixels_size) return SDL_FALSE;
+
+	for(int i = 0; i < header.num_glyphs; i++) {
+		const FOX_Glyph *glyph = &glyphs[i];
+		const SDL_Rect *rect = &glyph->metrics.rect;
+		if(glyph->state != FOX_GLYPH_LOADED) continue;
+		if(glyph->page >= header.num_pages || rect->x < 0 || rect->y < 0
+			|| rect->x + rect->w > pages[glyph->page].w
+			|| rect->y + rect->h > pages[glyph->page].h
+		) {
+			return SDL_FALSE;
+		}
+	}
+
+	/* Create the textures */
+	font->pages = SDL_calloc(header.num_pages, sizeof(*font->pages));
+	if(!font->pages) return SDL_FALSE;
+	font->num_pages = header.num_pages;
+	for(int i = 0; i < header.num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		page->w = pages[i].w;
+		page->h = pages[i].h;
+		page->used = pages[i].used;
+		int pitch = page->w * sizeof(Uint32);
+		if(upload) {
+			if(!FOX_CreatePageTexture(font, page, pixels, pitch)) goto abort;
+		} else {
+			page->surface = SDL_CreateRGBSurfaceWithFormat(0, page->w,
+									page->h, 32, SDL_PIXELFORMAT_RGBA32);
+			if(!page->surface) goto abort;
+			for(int y = 0; y < page->h; y++) {
+				SDL_memcpy((Uint8*)page->surface->pixels
+								+ y * page->surface->pitch,
+							pixels + (size_t)y * pitch, pitch);
+			}
+		}
+		pixels += (size_t)page->h * pitch;
+	}
+
+	SDL_memcpy(font->glyphs, glyphs, glyphs_size);
+	font->size = header.metrics;
+	return SDL_TRUE;
+
+	abort:
+		FOX_FreePages(font);
+		return SDL_FALSE;
+}
+
+/* Loads the atlas of a font from its cache file. */
+static SDL_bool FOX_LoadAtlasCache(FOX_SharedFont *font, const char *path,
+									const char *cache, SDL_bool upload
+) {
+	size_t size = 0;
+	void *data = FOX_MapFile(cache, &size);
+	if(!data) return SDL_FALSE;
+
+	SDL_bool loaded = FOX_LoadCacheData(font, path, data, size, upload);
+	FOX_UnmapFile(data, size);
+	return loaded;
+}
+
+/* Writes the trimmed pages of a freshly rasterized static atlas to its
+ * cache file. The file is written under a temporary name and renamed,
+ * so that other processes never map a partially written file. */
+static void FOX_SaveAtlasCache(FOX_SharedFont *font, const char *path,
+												const char *cache
+) {
+	FOX_CacheHeader header;
+	if(!FOX_InitCacheHeader(font, path, &header)) return;
+	header.num_pages = font->num_pages;
+	header.metrics = font->size;
+
+	size_t length = SDL_strlen(cache) + 5;
+	char *temp = SDL_malloc(length);
+	if(!temp) return;
+	SDL_snprintf(temp, length, "%s.tmp", cache);
+
+	SDL_RWops *file = SDL_RWFromFile(temp, "wb");
+	if(!file) {
+		SDL_free(temp);
+		return;
+	}
+
+	size_t padding = FOX_CACHE_PATH_SIZE(header.path_length)
+												- header.path_length;
+	SDL_bool written = SDL_RWwrite(file, &header, sizeof(header), 1) == 1
+		&& SDL_RWwrite(file, path, header.path_length, 1) == 1
+		&& SDL_RWwrite(file, "\0\0\0\0\0\0\0", 1, padding) == padding
+		&& SDL_RWwrite(file, font->glyphs, sizeof(FOX_Glyph),
+						header.num_glyphs) == (size_t)header.num_glyphs;
+
+	for(int i = 0; written && i < font->num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		FOX_CachePage info = {page->w, page->h, page->used};
+		written = SDL_RWwrite(file, &info, sizeof(info), 1) == 1;
+	}
+
+	for(int i = 0; written && i < font->num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		const Uint8 *row = page->surface->pixels;
+		for(int y = 0; written && y < page->h; y++) {
+			written = SDL_RWwrite(file, row, page->w * sizeof(Uint32), 1) == 1;
+			row += page->surface->pitch;
+		}
+	}
+
+	if(SDL_RWclose(file) == 0 && written) {
+		remove(cache);
+		if(rename(temp, cache) != 0) remove(temp);
+	} else {
+		remove(temp);
+	}
+	SDL_free(temp);
+}
+
+/******************************************************************************
+ * Fontconfig match cache
+ *****************************************************************************/
+
+#ifdef FOX_USE_FONTCONFIG
+
+/* Bump whenever the layout of the match cache file changes */
+#define FOX_FC_CACHE_VERSION 1
+
+#define FOX_IS_FC_SEPARATOR(c) ((c) == ':' || (c) == '=' || (c) == ',')
+
+/* Copies a fontconfig string, collapsing runs of whitespace and dropping
+ * whitespace around separators, so equivalent spellings share an entry. */
+static char* FOX_NormalizeFcPattern(const unsigned char *fontstr) {
+	char *pattern = SDL_malloc(SDL_strlen((const char*)fontstr) + 1);
+	if(!pattern) return NULL;
+
+	size_t n = 0;
+	SDL_bool space = SDL_FALSE;
+	for(const unsigned char *c = fontstr; *c; c++) {
+		if(SDL_isspace(*c)) {
+			space = SDL_TRUE;
+		} else if(FOX_IS_FC_SEPARATOR(*c)) {
+			pattern[n++] = *c;
+			space = SDL_FALSE;
+		} else {
+			if(space && n > 0 && !FOX_IS_FC_SEPARATOR(pattern[n - 1])) {
+				pattern[n++] = ' ';
+			}
+			space = SDL_FALSE;
+			if(*c == '\\' && c[1]) pattern[n++] = *c++;
+			pattern[n++] = *c;
+		}
+	}
+	pattern[n] = '\0';
+	return pattern;
+}
+
+static void FOX_FreeFcMatch(FOX_FcMatch *match) {
+	SDL_free(match->pattern);
+	SDL_free(match->path);
+	SDL_free(match);
+}
+
+/* Looks up a normalized pattern. The registry lock has to be held. */
+static FOX_FcMatch* FOX_FindFcMatch(const char *pattern) {
+	FOX_FcMatch *match = FOX_fc_matches;
+	while(match && SDL_strcmp(match->pattern, pattern) != 0) {
+		match = match->next;
+	}
+	return match;
+}
+
+/* Adds a copy of a match to the cache, unless its pattern has been added
+ * in the meantime. Takes ownership of the pattern. */
+static void FOX_AddFcMatch(char *pattern, const FOX_FcMatch *match) {
+	FOX_FcMatch *entry = SDL_malloc(sizeof(*entry));
+	if(!entry) {
+		SDL_free(pattern);
+		return;
+	}
+	*entry = *match;
+	entry->pattern = pattern;
+	entry->path = SDL_strdup(match->path);
+	if(!entry->path) {
+		FOX_FreeFcMatch(entry);
+		return;
+	}
+
+	SDL_LockMutex(FOX_registry_lock);
+	if(FOX_FindFcMatch(pattern)) {
+		FOX_FreeFcMatch(entry);
+	} else {
+		entry->next = FOX_fc_matches;
+		FOX_fc_matches = entry;
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+}
+
+/* Runs fontconfig to find the font matching a normalized pattern. */
+static SDL_bool FOX_MatchFcPattern(const char *pattern, FOX_FcMatch *match) {
+	FcPattern *query = FcNameParse((const FcChar8*)pattern);
+	if(!query) return SDL_FALSE;
+
+	FcConfigSubstitute(NULL, query, FcMatchPattern);
+	FcDefaultSubstitute(query);
+	FcResult result;
+	FcPattern *font = FcFontMatch(NULL, query, &result);
+	FcPatternDestroy(query);
+	if(!font) return SDL_FALSE;
+
+	FcChar8 *path;
+	SDL_zerop(match);
+	if(FcPatternGetString(font, FC_FILE, 0, &path) == FcResultMatch) {
+		match->path = SDL_strdup((const char*)path);
+	}
+	FcPatternGetInteger(font, FC_INDEX, 0, &match->index);
+	FcPatternGetInteger(font, FC_SIZE, 0, &match->size);
+	FcPatternDestroy(font);
+	return match->path != NULL;
+}
+
+/* Resolves a fontconfig string to font file, face index and size, running
+ * fontconfig only for strings that have not been resolved before.
+ * The path of the result has to be freed by the caller. */
+static SDL_bool FOX_ResolveFcPattern(const unsigned char *fontstr,
+										FOX_FcMatch *match
+) {
+	char *pattern = FOX_NormalizeFcPattern(fontstr);
+	if(!pattern) return SDL_FALSE;
+
+	SDL_LockMutex(FOX_registry_lock);
+	FOX_FcMatch *cached = FOX_FindFcMatch(pattern);
+	if(cached) {
+		*match = *cached;
+		match->path = SDL_strdup(cached->path);
+	}
+	SDL_UnlockMutex(FOX_registry_lock);
+	if(cached) {
+		SDL_free(pattern);
+		return match->path != NULL;
+	}
+
+	/* Matching may take a while, so it is done without holding the lock */
+	if(!FOX_MatchFcPattern(pattern, match)) {
+		SDL_free(pattern);
+		return SDL_FALSE;
+	}
+	FOX_AddFcMatch(pattern, match);
+	return SDL_TRUE;
+}
+
+/* Hashes the fontconfig version along with the font directories and their
+ * modification times, which change whenever fonts are (un)installed. */
+static Uint64 FOX_FcConfigStamp(void) {
+	int version = FcGetVersion();
+	Uint64 hash = FOX_HashBytes(FOX_FNV_OFFSET, &version, sizeof(version));
+
+	FcStrList *dirs = FcConfigGetFontDirs(NULL);
+	if(!dirs) return hash;
+	for(FcChar8 *dir; (dir = FcStrListNext(dirs)); ) {
+		struct stat info;
+		Sint64 mtime = stat((const char*)dir, &info) == 0 ? info.st_mtime : -1;
+		hash = FOX_HashBytes(hash, dir, SDL_strlen((const char*)dir) + 1);
+		hash = FOX_HashBytes(hash, &mtime, sizeof(mtime));
+	}
+	FcStrListDone(dirs);
+	return hash;
+}
+
+/* The first line of a match cache file, followed by one line per match:
+ * size, index, pattern and path separated by tabs. */
+static void FOX_FcCacheHeader(char *header, size_t length) {
+	Uint64 stamp = FOX_FcConfigStamp();
+	SDL_snprintf(header, length, "FOXFC %d %08x%08x\n", FOX_FC_CACHE_VERSION,
+									(Uint32)(stamp >> 32), (Uint32)stamp);
+}
+
+/* Adds a line of a match cache file to the cache, unless it is malformed
+ * or refers to a font file that no longer exists. */
+static void FOX_ParseFcMatch(char *line) {
+	FOX_FcMatch match;
+	char *end;
+	match.size = SDL_strtol(line, &end, 10);
+	if(*end != '\t' || match.size <= 0) return;
+	match.index = SDL_strtol(end + 1, &end, 10);
+	if(*end != '\t' || match.index < 0) return;
+
+	char *pattern = end + 1;
+	match.path = SDL_strchr(pattern, '\t');
+	if(!match.path) return;
+	*match.path++ = '\0';
+
+	struct stat info;
+	if(stat(match.path, &info) != 0) return;
+	if((pattern = SDL_strdup(pattern))) FOX_AddFcMatch(pattern, &match);
+}
+
+static void FOX_LoadFcCache(const char *path) {
+	size_t size;
+	char *data = SDL_LoadFile(path, &size);
+	if(!data) return;
+
+	char header[64];
+	FOX_FcCacheHeader(header, sizeof(header));
+	size_t length = SDL_strlen(header);
+	if(size >= length && SDL_memcmp(data, header, length) == 0) {
+		char *line = data + length;
+		for(char *end; (end = SDL_strchr(line, '\n')); line = end + 1) {
+			*end = '\0';
+			FOX_ParseFcMatch(line);
+		}
+	}
+	SDL_free(data);
+}
+
+static SDL_bool FOX_WriteString(SDL_RWops *file, const char *string) {
+	size_t length = SDL_strlen(string);
+	return SDL_RWwrite(file, string, 1, length) == length;
+}
+
+static void FOX_SaveFcCache(const char *path) {
+	size_t length = SDL_strlen(path) + 5;
+	char *temp = SDL_malloc(length);
+	if(!temp) return;
+	SDL_snprintf(temp, length, "%s.tmp", path);
+
+	SDL_RWops *file = SDL_RWFromFile(temp, "wb");
+	if(!file) {
+		SDL_free(temp);
+		return;
+	}
+
+	char line[64];
+	FOX_FcCacheHeader(line, sizeof(line));
+	SDL_bool written = FOX_WriteString(file, line);
+	for(FOX_FcMatch *match = FOX_fc_matches; written && match;
+										match = match->next
+	) {
+		/* Skip what cannot be told apart from the separators */
+		if(SDL_strchr(match->pattern, '\t') || SDL_strchr(match->pattern, '\n')
+			|| SDL_strchr(match->path, '\t') || SDL_strchr(match->path, '\n')
+		) {
+			continue;
+		}
+		SDL_snprintf(line, sizeof(line), "%d\t%d\t", match->size, match->index);
+		written = FOX_WriteString(file, line)
+			&& FOX_WriteString(file, match->pattern)
+			&& FOX_WriteString(file, "\t")
+			&& FOX_WriteString(file, match->path)
+			&& FOX_WriteString(file, "\n");
+	}
+
+	if(SDL_RWclose(file) == 0 && written) {
+		remove(path);
+		if(rename(temp, path) != 0) remove(temp);
+	} else {
+		remove(temp);
+	}
+	SDL_free(temp);
+}
+
+SDL_bool FOX_SetFcCacheFile(const char *path) {
+	char *file = NULL;
+	if(path && !(file = SDL_strdup(path))) return SDL_FALSE;
+	SDL_free(FOX_fc_cache_file);
+	FOX_fc_cache_file = file;
+	if(file) FOX_LoadFcCache(file);
+	return SDL_TRUE;
+}
+
+/* Fontconfig strings resolved by one FOX_PrewarmFc() call */
+typedef struct {
+	unsigned char **fontstrs;
+	int count;
+	SDL_Thread *previous;	/* thread of the preceding call */
+} FOX_FcPrewarm;
+
+static int SDLCALL FOX_PrewarmWorker(void *data) {
+	FOX_FcPrewarm *prewarm = data;
+
+	/* Calls are served in order and there is only one thread to wait for */
+	SDL_WaitThread(prewarm->previous, NULL);
+
+	for(int i = 0; i < prewarm->count; i++) {
+		FOX_FcMatch match;
+		if(!SDL_AtomicGet(&FOX_fc_cancel)
+			&& FOX_ResolveFcPattern(prewarm->fontstrs[i], &match)
+		) {
+			SDL_free(match.path);
+		}
+		SDL_free(prewarm->fontstrs[i]);
+	}
+	SDL_free(prewarm->fontstrs);
+	SDL_free(prewarm);
+	return 0;
+}
+
+SDL_bool FOX_PrewarmFc(const unsigned char *const *fontstrs, int count) {
+	if(count <= 0) return SDL_TRUE;
+
+	FOX_FcPrewarm *prewarm = SDL_calloc(1, sizeof(*prewarm));
+	if(!prewarm) return SDL_FALSE;
+	prewarm->fontstrs = SDL_calloc(count, sizeof(*prewarm->fontstrs));
+	if(!prewarm->fontstrs) goto abort0;
+
+	for(; prewarm->count < count; prewarm->count++) {
+		const char *fontstr = (const char*)fontstrs[prewarm->count];
+		prewarm->fontstrs[prewarm->count] = (unsigned char*)SDL_strdup(fontstr);
+		if(!prewarm->fontstrs[prewarm->count]) goto abort1;
+	}
+
+	prewarm->previous = FOX_fc_prewarm;
+	SDL_Thread *thread = SDL_CreateThread(FOX_PrewarmWorker, "FOX_PrewarmFc",
+																prewarm);
+	if(!thread) goto abort1;
+	FOX_fc_prewarm = thread;
+	return SDL_TRUE;
+
+	/* Premature error handling */
+	abort1:
+		for(int i = 0; i < prewarm->count; i++) {
+			SDL_free(prewarm->fontstrs[i]);
+		}
+		SDL_free(prewarm->fontstrs);
+	abort0:
+		SDL_free(prewarm);
+		return SDL_FALSE;
+}
+
+/* Stops prewarming, writes the cache file and forgets all matches. */
+static void FOX_ClearFcCache(void) {
+	SDL_AtomicSet(&FOX_fc_cancel, 1);
+	SDL_WaitThread(FOX_fc_prewarm, NULL);
+	SDL_AtomicSet(&FOX_fc_cancel, 0);
+	FOX_fc_prewarm = NULL;
+
+	if(FOX_fc_cache_file) FOX_SaveFcCache(FOX_fc_cache_file);
+	SDL_free(FOX_fc_cache_file);
+	FOX_fc_cache_file = NULL;
+
+	while(FOX_fc_matches) {
+		FOX_FcMatch *match = FOX_fc_matches;
+		FOX_fc_matches = match->next;
+		FOX_FreeFcMatch(match);
+	}
+}
+
+#endif /* FOX_USE_FONTCONFIG */
+
+/******************************************************************************
+ * Character map
+ *****************************************************************************/
+
+/* Returns the glyph index of a character. Lookups are cached in a two-level
+ * table, so that the charmap of the face is consulted once per character. */
+static FT_UInt FOX_GetGlyphIndex(FOX_SharedFont *font, Uint32 ch) {
+	if(ch >= 0x110000) return FT_Get_Char_Index(font->face, ch);
+
+	Uint32 **page = &font->charmap[ch >> FOX_CHARMAP_SHIFT];
+	if(!*page) {
+		*page = SDL_malloc(sizeof(**page) << FOX_CHARMAP_SHIFT);
+		if(!*page) return FT_Get_Char_Index(font->face, ch);
+		SDL_memset(*page, 0xFF, sizeof(**page) << FOX_CHARMAP_SHIFT);
+	}
+
+	Uint32 *entry = &(*page)[ch & FOX_CHARMAP_MASK];
+	if(*entry == FOX_CHARMAP_UNKNOWN) {
+		*entry = FT_Get_Char_Index(font->face, ch);
+	}
+	return *entry;
+}
+
+static void FOX_FreeCharmap(FOX_SharedFont *font) {
+	for(int i = 0; i < FOX_CHARMAP_PAGES; i++) {
+		SDL_free(font->charmap[i]);
+		font->charmap[i] = NULL;
+	}
+}
+
+/******************************************************************************
+ * Kerning cache
+ *****************************************************************************/
+
+/* Upper bound of cached pairs outside of the dense range */
+#define FOX_KERNING_MAX_PAIRS 65536
+
+static int FOX_LoadKerning(FOX_SharedFont *font, FT_UInt previous,
+														FT_UInt index
+) {
+	FOX_COUNT(font, kerning_misses, 1);
+	FT_Vector delta;
+	if(FT_Get_Kerning(font->face, previous, index, FT_KERNING_DEFAULT,
+																&delta)
+	) {
+		return 0;
+	}
+	return delta.x >> 6;
+}
+
+/* Returns the row of the dense matrix for a preceding character,
+ * computing it on first use. Returns NULL if out of memory. */
+static const Sint16* FOX_GetKerningRow(FOX_SharedFont *font,
+														Uint32 previous_ch
+) {
+	FOX_KerningCache *cache = &font->kerning;
+	if(!cache->matrix) {
+		cache->matrix = SDL_calloc(FOX_KERNING_RANGE * FOX_KERNING_RANGE,
+												sizeof(*cache->matrix));
+		cache->rows = SDL_calloc(FOX_KERNING_RANGE, sizeof(*cache->rows));
+		if(!cache->matrix || !cache->rows) {
+			FOX_FreeKerning(font);
+			return NULL;
+		}
+	}
+
+	int row = previous_ch - FOX_KERNING_FIRST;
+	Sint16 *offsets = &cache->matrix[row * FOX_KERNING_RANGE];
+	if(!cache->rows[row]) {
+		FT_UInt previous = FOX_GetGlyphIndex(font, previous_ch);
+		for(int i = 0; previous && i < FOX_KERNING_RANGE; i++) {
+			FT_UInt index = FOX_GetGlyphIndex(font, FOX_KERNING_FIRST + i);
+			if(index) offsets[i] = FOX_LoadKerning(font, previous, index);
+		}
+		cache->rows[row] = 1;
+	}
+	return offsets;
+}
+
+static Uint32 FOX_HashKerningPair(FT_UInt previous, FT_UInt index) {
+	Uint32 hash = ((Uint32)previous << 16 ^ index) * 0x9E3779B1u;
+	return hash ^ hash >> 16;
+}
+
+/* Grows the hash table to twice its size, or empties it once the
+ * maximum number of pairs is reached. */
+static SDL_bool FOX_GrowKerningPairs(FOX_KerningCache *cache) {
+	int capacity = cache->capacity ? cache->capacity * 2 : 256;
+	if(capacity > FOX_KERNING_MAX_PAIRS * 2) {
+		SDL_memset(cache->pairs, 0, sizeof(*cache->pairs) * cache->capacity);
+		cache->num_pairs = 0;
+		return SDL_TRUE;
+	}
+
+	FOX_KerningPair *pairs = SDL_calloc(capacity, sizeof(*pairs));
+	if(!pairs) return SDL_FALSE;
+	for(int i = 0; i < cache->capacity; i++) {
+		FOX_KerningPair *pair = &cache->pairs[i];
+		if(pair->previous == 0) continue;
+		Uint32 slot = FOX_HashKerningPair(pair->previous, pair->index);
+		while(pairs[slot & (capacity - 1)].previous) slot++;
+		pairs[slot & (capacity - 1)] = *pair;
+	}
+
+	SDL_free(cache->pairs);
+	cache->pairs = pairs;
+	cache->capacity = capacity;
+	return SDL_TRUE;
+}
+
+/* Looks up the kerning of a glyph pair in the hash table. */
+static int FOX_GetHashedKerning(FOX_SharedFont *font, FT_UInt previous,
+												FT_UInt index
+) {
+	FOX_KerningCache *cache = &font->kerning;
+	if(cache->num_pairs * 2 >= cache->capacity
+		&& !FOX_GrowKerningPairs(cache)
+	) {
+		return FOX_LoadKerning(font, previous, index);
+	}
+
+	Uint32 mask = cache->capacity - 1;
+	Uint32 slot = FOX_HashKerningPair(previous, index);
+	for(;; slot++) {
+		FOX_KerningPair *pair = &cache->pairs[slot & mask];
+		if(pair->previous == previous && pair->index == index) {
+			return pair->offset;
+		} else if(pair->previous == 0) {
+			pair->previous = previous;
+			pair->index = index;
+			pair->offset = FOX_LoadKerning(font, previous, index);
+			cache->num_pairs++;
+			return pair->offset;
+		}
+	}
+}
+
+/* Computes the dense matrix of a font whose atlas is built upon opening,
+ * so that rendering never has to consult freetype for common pairs. */
+static void FOX_PrecomputeKerning(FOX_SharedFont *font) {
+	if(!FT_HAS_KERNING(font->face)) return;
+	for(Uint32 ch = FOX_KERNING_FIRST; ch <= FOX_KERNING_LAST; ch++) {
+		if(!FOX_GetKerningRow(font, ch)) break;
+	}
+}
+
+static void FOX_FreeKerning(FOX_SharedFont *font) {
+	FOX_KerningCache *cache = &font->kerning;
+	SDL_free(cache->matrix);
+	SDL_free(cache->rows);
+	SDL_free(cache->pairs);
+	SDL_zerop(cache);
+}
+
+/* Returns the glyph for a character, rasterizing it on demand. */
+static FOX_Glyph* FOX_GetGlyph(FOX_SharedFont *font, Uint32 ch) {
+	FT_UInt glyph_index = FOX_GetGlyphIndex(font, ch);
+	if(glyph_index == 0) {
+		FOX_COUNT(font, glyph_misses, 1);
+		return NULL;
+	}
+
+	FOX_Glyph *glyph = &font->glyphs[glyph_index];
+	if(glyph->state == FOX_GLYPH_LOADED) {
+		FOX_COUNT(font, glyph_hits, 1);
+		return glyph;
+	}
+
+	FOX_COUNT(font, glyph_misses, 1);
+	if(glyph->state == FOX_GLYPH_EMPTY && (font->flags & FOX_OPEN_DYNAMIC)) {
+		Uint64 start = FOX_TIMESTAMP();
+		FOX_LoadGlyph(font, glyph_index);
+		FOX_TIME(font, rasterize_ticks, start);
+	}
+	return glyph->state == FOX_GLYPH_LOADED ? glyph : NULL;
+}
+
+/******************************************************************************
+ * Fallback fonts
+ *****************************************************************************/
+
+/* Returns font i of the fallback chain of a font, the font itself first. */
+static FOX_SharedFont* FOX_ChainFont(FOX_Font *font, int i) {
+	return i == 0 ? font->shared : font->fallbacks[i - 1];
+}
+
+static void FOX_FreeFallbackMap(FOX_Font *font) {
+	for(int i = 0; i < FOX_CHARMAP_PAGES; i++) {
+		SDL_free(font->fallback_map[i]);
+		font->fallback_map[i] = NULL;
+	}
+}
+
+/* Appends a font to the fallback chain, taking over a reference to it. */
+static SDL_bool FOX_AppendFallback(FOX_Font *font, FOX_SharedFont *fallback) {
+	if(font->num_fallbacks == FOX_MAX_FALLBACKS) {
+		SDL_SetError("Too many fallback fonts");
+		return SDL_FALSE;
+	}
+
+	FOX_SharedFont **fallbacks = SDL_realloc(font->fallbacks,
+					sizeof(*fallbacks) * (font->num_fallbacks + 1));
+	if(!fallbacks) return SDL_FALSE;
+	font->fallbacks = fallbacks;
+	font->fallbacks[font->num_fallbacks++] = fallback;
+	fallback->color = font->shared->color;
+	fallback->target = font->shared->target;
+	font->generation++;
+	return SDL_TRUE;
+}
+
+SDL_bool FOX_AddFallbackFont(FOX_Font *font, FOX_Font *fallback) {
+	if(fallback->shared->renderer != font->shared->renderer
+					|| fallback->shared == font->shared) {
+		SDL_SetError("Fallback font must be another font of the same renderer");
+		return SDL_FALSE;
+	}
+
+	/* The chain is searched right away, so it only takes loaded fonts */
+	if(FOX_WaitFont(fallback) != FOX_FONT_READY) return SDL_FALSE;
+
+	FOX_RetainFont(fallback->shared);
+	if(!FOX_AppendFallback(font, fallback->shared)) {
+		FOX_ReleaseFont(fallback->shared);
+		return SDL_FALSE;
+	}
+
+	/* Characters missing so far may be provided by the new font */
+	FOX_FreeFallbackMap(font);
+	return SDL_TRUE;
+}
+
+void FOX_ClearFallbackFonts(FOX_Font *font) {
+	for(int i = 0; i < font->num_fallbacks; i++) {
+		FOX_ReleaseFont(font->fallbacks[i]);
+	}
+	SDL_free(font->fallbacks);
+	font->fallbacks = NULL;
+	font->num_fallbacks = 0;
+	FOX_FreeFallbackMap(font);
+	font->generation++;
+}
+
+#ifdef FOX_USE_FONTCONFIG
+void FOX_EnableFcFallback(FOX_Font *font, SDL_bool enable) {
+	if(font->fc_fallback != enable) {
+		font->fc_fallback = enable;
+		FOX_FreeFallbackMap(font);
+		font->generation++;
+	}
+}
+
+/* Asks fontconfig for a font providing a character and appends it to the
+ * fallback chain. The font is opened at the same size with glyphs being
+ * rasterized on first use, as such fonts tend to be large. */
+static SDL_bool FOX_AddFcFallback(FOX_Font *font, Uint32 ch) {
+	FcPattern *pattern = FcPatternCreate();
+	FcCharSet *charset = FcCharSetCreate();
+	if(!pattern || !charset
+		|| !FcCharSetAddChar(charset, ch)
+		|| !FcPatternAddCharSet(pattern, FC_CHARSET, charset)
+	) {
+		goto abort0;
+	}
+	const FT_Face face = font->shared->face;
+	if(face->family_name) {
+		FcPatternAddString(pattern, FC_FAMILY,
+							(const FcChar8*)face->family_name);
+	}
+
+	FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+	FcDefaultSubstitute(pattern);
+	FcResult result;
+	FcPattern *match = FcFontMatch(NULL, pattern, &result);
+	if(!match) goto abort0;
+
+	FcChar8 *path;
+	FcCharSet *provided;
+	int index = 0;
+	FOX_SharedFont *fallback = NULL;
+	FcPatternGetInteger(match, FC_INDEX, 0, &index);
+	if(FcPatternGetCharSet(match, FC_CHARSET, 0, &provided) == FcResultMatch
+		&& FcCharSetHasChar(provided, ch)
+		&& FcPatternGetString(match, FC_FILE, 0, &path) == FcResultMatch
+	) {
+		/* Fallbacks of a font with an atlas budget get the same budget */
+		const FOX_SharedFont *shared = font->shared;
+		fallback = FOX_ShareFont(shared->renderer, (const char*)path,
+					NULL, 0, index, shared->size.ptsize,
+					shared->flags | FOX_OPEN_DYNAMIC, shared->atlas_budget);
+	}
+	FcPatternDestroy(match);
+	if(!fallback) goto abort0;
+
+	/* Fonts are shared, so the match may be the font itself or already
+	 * be part of the chain */
+	SDL_bool chained = fallback == font->shared;
+	for(int i = 0; i < font->num_fallbacks; i++) {
+		chained |= fallback == font->fallbacks[i];
+	}
+	if(chained || !FOX_GetGlyphIndex(fallback, ch)
+		|| !FOX_AppendFallback(font, fallback)
+	) {
+		FOX_ReleaseFont(fallback);
+		goto abort0;
+	}
+
+	FcCharSetDestroy(charset);
+	FcPatternDestroy(pattern);
+	return SDL_TRUE;
+
+	/* Premature error handling */
+	abort0:
+		if(charset) FcCharSetDestroy(charset);
+		if(pattern) FcPatternDestroy(pattern);
+		return SDL_FALSE;
+}
+#endif /* FOX_USE_FONTCONFIG */
+
+/* Returns 1 + the index of the first fallback providing a character. */
+static Uint8 FOX_FindFallback(FOX_Font *font, Uint32 ch) {
+	for(int i = 0; i < font->num_fallbacks; i++) {
+		if(FOX_GetGlyphIndex(font->fallbacks[i], ch)) return i + 1;
+	}
+	#ifdef FOX_USE_FONTCONFIG
+	if(font->fc_fallback && font->num_fallbacks < FOX_MAX_FALLBACKS
+		&& FOX_AddFcFallback(font, ch)
+	) {
+		return font->num_fallbacks;
+	}
+	#endif
+	return FOX_FALLBACK_NONE;
+}
+
+/* Returns the glyph of a character and the font of the fallback chain it
+ * belongs to. The font providing a character is looked up once and then
+ * kept in a two-level table like the one of the character map. */
+static FOX_Glyph* FOX_ResolveGlyph(FOX_Font *font, Uint32 ch,
+											FOX_SharedFont **owner
+) {
+	*owner = font->shared;
+	FOX_Glyph *glyph = FOX_GetGlyph(font->shared, ch);
+	if(glyph || ch >= 0x110000
+		|| (font->num_fallbacks == 0 && !font->fc_fallback)
+	) {
+		return glyph;
+	}
+
+	Uint8 **page = &font->fallback_map[ch >> FOX_CHARMAP_SHIFT];
+	if(!*page) {
+		*page = SDL_calloc(1 << FOX_CHARMAP_SHIFT, sizeof(**page));
+		if(!*page) return NULL;
+	}
+
+	Uint8 *entry = &(*page)[ch & FOX_CHARMAP_MASK];
+	if(*entry == FOX_FALLBACK_UNKNOWN) {
+		*entry = FOX_FindFallback(font, ch);
+	}
+	if(*entry == FOX_FALLBACK_NONE) return NULL;
+
+	*owner = font->fallbacks[*entry - 1];
+	return FOX_GetGlyph(*owner, ch);
+}
+
+/* Returns a stamp of the state quads laid out with a font depend on.
+ * It changes along with the fallback chain and whenever glyphs are
+ * evicted from the atlas of a font of the chain. */
+static Uint64 FOX_LayoutGeneration(FOX_Font *font) {
+	Uint32 evictions = 0;
+	for(int i = 0; i <= font->num_fallbacks; i++) {
+		evictions += FOX_ChainFont(font, i)->evictions;
+	}
+	return (Uint64)font->generation << 32 | evictions;
+}
+
+/******************************************************************************
+ * Surface blending
+ *****************************************************************************/
+
+struct FOX_Target {
+	SDL_Surface *surface;
+	SDL_Rect clip;		/* clip rect of the surface */
+	SDL_Color color;
+	Uint32 pixel;		/* opaque color in the format of the surface */
+	SDL_bool packed;	/* 32-bit pixels with 8 bits per channel */
+};
+
+/* x / 255 rounded to nearest for 0 <= x <= 255 * 255 */
+#define FOX_DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+/* FOX_DIV255() of the two 16-bit halves of x at once, each moved down
+ * into the low byte of its half */
+#define FOX_DIV255X2(x) ((((x) + 0x00800080u \
+			+ (((x) + 0x00800080u) >> 8 & 0x00FF00FFu)) >> 8) & 0x00FF00FFu)
+
+/* Blends a color into a row of 32-bit pixels with 8 bits per channel,
+ * weighted by a row of 8-bit coverage values scaled by alpha. The color
+ * is an opaque pixel in the format of the destination, so every channel,
+ * including alpha, is interpolated the same way. */
+typedef void (*FOX_BlendRowFunc)(Uint32 *dst, const Uint8 *coverage,
+								int width, Uint32 color, Uint8 alpha);
+
+static void FOX_BlendRowScalar(Uint32 *dst, const Uint8 *coverage,
+								int width, Uint32 color, Uint8 alpha
+) {
+	for(int x = 0; x < width; x++) {
+		Uint32 a = FOX_DIV255(coverage[x] * alpha);
+		if(a == 0) continue;
+
+		/* Two channels at a time, one in each 16-bit half */
+		Uint32 rb = (color & 0x00FF00FFu) * a
+					+ (dst[x] & 0x00FF00FFu) * (255 - a);
+		Uint32 ga = (color >> 8 & 0x00FF00FFu) * a
+					+ (dst[x] >> 8 & 0x00FF00FFu) * (255 - a);
+		dst[x] = FOX_DIV255X2(rb) | FOX_DIV255X2(ga) << 8;
+	}
+}
+
+#ifdef FOX_HAVE_SSE2_KERNEL
+#ifdef __GNUC__
+__attribute__((target("sse2")))
+#endif
+static __m128i FOX_Div255SSE2(__m128i x) {
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* Blends 4 pixels given the coverage of each repeated for its channels */
+#ifdef __GNUC__
+__attribute__((target("sse2")))
+#endif
+static void FOX_Blend4SSE2(Uint32 *dst, __m128i coverage, __m128i color,
+														__m128i alpha
+) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max = _mm_set1_epi16(255);
+	__m128i pixels = _mm_loadu_si128((const __m128i*)dst);
+
+	__m128i a = FOX_Div255SSE2(_mm_mullo_epi16(
+							_mm_unpacklo_epi8(coverage, zero), alpha));
+	__m128i lo = FOX_Div255SSE2(_mm_add_epi16(_mm_mullo_epi16(color, a),
+				_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero),
+											_mm_sub_epi16(max, a))));
+	a = FOX_Div255SSE2(_mm_mullo_epi16(
+							_mm_unpackhi_epi8(coverage, zero), alpha));
+	__m128i hi = FOX_Div255SSE2(_mm_add_epi16(_mm_mullo_epi16(color, a),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero),
+											_mm_sub_epi16(max, a))));
+
+	_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+}
+
+#ifdef __GNUC__
+__attribute__((target("sse2")))
+#endif
+static void FOX_BlendRowSSE2(Uint32 *dst, const Uint8 *coverage,
+								int width, Uint32 color, Uint8 alpha
+) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)color),
+																zero);
+	const __m128i alpha16 = _mm_set1_epi16(alpha);
+	int x = 0;
+	for(; x + 8 <= width; x += 8) {
+		__m128i c = _mm_loadl_epi64((const __m128i*)&coverage[x]);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) == 0xFFFF) continue;
+
+		/* Repeat the coverage of each pixel for its four channels */
+		c = _mm_unpacklo_epi8(c, c);
+		FOX_Blend4SSE2(&dst[x], _mm_unpacklo_epi16(c, c), color16, alpha16);
+		FOX_Blend4SSE2(&dst[x + 4], _mm_unpackhi_epi16(c, c), color16,
+																alpha16);
+	}
+	FOX_BlendRowScalar(&dst[x], &coverage[x], width - x, color, alpha);
+}
+#endif /* FOX_HAVE_SSE2_KERNEL */
+
+#ifdef FOX_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static __m256i FOX_Div255AVX2(__m256i x) {
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void FOX_BlendRowAVX2(Uint32 *dst, const Uint8 *coverage,
+								int width, Uint32 color, Uint8 alpha
+) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi16(255);
+	const __m256i color16 = _mm256_unpacklo_epi8(
+								_mm256_set1_epi32((int)color), zero);
+	const __m256i alpha16 = _mm256_set1_epi16(alpha);
+
+	/* Repeats the coverage of pixels 0-3 in the lower and pixels 4-7 in
+	 * the upper lane for their four channels each */
+	const __m256i repeat = _mm256_setr_epi8(
+		0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+		4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+	int x = 0;
+	for(; x + 8 <= width; x += 8) {
+		__m128i c = _mm_loadl_epi64((const __m128i*)&coverage[x]);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_setzero_si128()))
+															== 0xFFFF
+		) {
+			continue;
+		}
+
+		__m256i cover = _mm256_shuffle_epi8(
+							_mm256_broadcastsi128_si256(c), repeat);
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&dst[x]);
+
+		__m256i a = FOX_Div255AVX2(_mm256_mullo_epi16(
+							_mm256_unpacklo_epi8(cover, zero), alpha16));
+		__m256i lo = FOX_Div255AVX2(_mm256_add_epi16(
+				_mm256_mullo_epi16(color16, a),
+				_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero),
+											_mm256_sub_epi16(max, a))));
+		a = FOX_Div255AVX2(_mm256_mullo_epi16(
+							_mm256_unpackhi_epi8(cover, zero), alpha16));
+		__m256i hi = FOX_Div255AVX2(_mm256_add_epi16(
+				_mm256_mullo_epi16(color16, a),
+				_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero),
+											_mm256_sub_epi16(max, a))));
+
+		_mm256_storeu_si256((__m256i*)&dst[x], _mm256_packus_epi16(lo, hi));
+	}
+	FOX_BlendRowScalar(&dst[x], &coverage[x], width - x, color, alpha);
+}
+#endif /* FOX_HAVE_AVX2_KERNEL */
+
+static FOX_BlendRowFunc FOX_BlendRow = FOX_BlendRowScalar;
+
+static void FOX_SelectBlendKernel(void) {
+	FOX_BlendRow = FOX_BlendRowScalar;
+	#ifdef FOX_HAVE_SSE2_KERNEL
+	if(SDL_HasSSE2()) FOX_BlendRow = FOX_BlendRowSSE2;
+	#endif
+	#ifdef FOX_HAVE_AVX2_KERNEL
+	if(SDL_HasAVX2()) FOX_BlendRow = FOX_BlendRowAVX2;
+	#endif
+}
+
+/* Blends a color into a row of pixels of any other format, one pixel at
+ * a time. */
+static void FOX_BlendRowGeneric(const SDL_PixelFormat *format, Uint8 *pixels,
+							const Uint8 *coverage, int width, SDL_Color color
+) {
+	int bpp = format->BytesPerPixel;
+	for(int x = 0; x < width; x++, pixels += bpp) {
+		Uint32 a = FOX_DIV255(coverage[x] * color.a);
+		if(a == 0) continue;
+
+		Uint32 pixel;
+		switch(bpp) {
+			case 1: pixel = *pixels; break;
+			case 2: pixel = *(Uint16*)pixels; break;
+			#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+			case 3: pixel = pixels[0] | pixels[1] << 8 | pixels[2] << 16; break;
+			#else
+			case 3: pixel = pixels[0] << 16 | pixels[1] << 8 | pixels[2]; break;
+			#endif
+			default: pixel = *(Uint32*)pixels; break;
+		}
+
+		Uint8 r, g, b, alpha;
+		SDL_GetRGBA(pixel, format, &r, &g, &b, &alpha);
+		pixel = SDL_MapRGBA(format,
+					FOX_DIV255(color.r * a + r * (255 - a)),
+					FOX_DIV255(color.g * a + g * (255 - a)),
+					FOX_DIV255(color.b * a + b * (255 - a)),
+					FOX_DIV255(255 * a + alpha * (255 - a)));
+
+		switch(bpp) {
+			case 1: *pixels = pixel; break;
+			case 2: *(Uint16*)pixels = pixel; break;
+			#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+			case 3:
+				pixels[0] = pixel;
+				pixels[1] = pixel >> 8;
+				pixels[2] = pixel >> 16;
+				break;
+			#else
+			case 3:
+				pixels[0] = pixel >> 16;
+				pixels[1] = pixel >> 8;
+				pixels[2] = pixel;
+				break;
+			#endif
+			default: *(Uint32*)pixels = pixel; break;
+		}
+	}
+}
+
+/* Blends the coverage of a glyph from its atlas page into the target,
+ * clipped to the clip rect of the target surface. */
+static void FOX_BlendGlyph(const FOX_Target *target,
+		const FOX_AtlasPage *page, const SDL_Rect *src, const SDL_Rect *dst
+) {
+	SDL_Rect rect;
+	if(!SDL_IntersectRect(dst, &target->clip, &rect)) return;
+
+	SDL_Surface *surface = target->surface;
+	int bpp = surface->format->BytesPerPixel;
+	const Uint8 *coverage = page->coverage
+						+ (src->y + rect.y - dst->y) * page->w
+						+ src->x + rect.x - dst->x;
+	Uint8 *pixels = (Uint8*)surface->pixels + rect.y * surface->pitch
+											+ rect.x * bpp;
+
+	for(int y = 0; y < rect.h; y++) {
+		if(target->packed) {
+			FOX_BlendRow((Uint32*)pixels, coverage, rect.w, target->pixel,
+														target->color.a);
+		} else {
+			FOX_BlendRowGeneric(surface->format, pixels, coverage, rect.w,
+														target->color);
+		}
+		coverage += page->w;
+		pixels += surface->pitch;
+	}
+}
+
+/* Directs the glyphs of a surface font and its fallbacks into a surface
+ * until FOX_EndTarget() is called. */
+static SDL_bool FOX_BeginTarget(FOX_Font *font, FOX_Target *target,
+							SDL_Surface *surface, SDL_Color color
+) {
+	if(!(font->shared->flags & FOX_OPEN_SURFACE)) {
+		SDL_SetError("Font was not opened with FOX_OPEN_SURFACE");
+		return SDL_FALSE;
+	}
+	if(!FOX_FontReady(font)) {
+		SDL_SetError("Font has not finished loading");
+		return SDL_FALSE;
+	}
+	if(SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) != 0) {
+		return SDL_FALSE;
+	}
+
+	/* Setting every bit outside of the color channels makes the color
+	 * opaque, whether the format has an alpha channel or not */
+	const SDL_PixelFormat *format = surface->format;
+	target->surface = surface;
+	SDL_GetClipRect(surface, &target->clip);
+	target->color = color;
+	target->pixel = SDL_MapRGBA(format, color.r, color.g, color.b, 255)
+					| ~(format->Rmask | format->Gmask | format->Bmask);
+	target->packed = format->BytesPerPixel == 4
+					&& format->Rmask == 0xFFu << format->Rshift
+					&& format->Gmask == 0xFFu << format->Gshift
+					&& format->Bmask == 0xFFu << format->Bshift
+					&& (format->Amask == 0
+						|| format->Amask == 0xFFu << format->Ashift);
+
+	for(int i = 0; i <= font->num_fallbacks; i++) {
+		FOX_ChainFont(font, i)->target = target;
+	}
+	return SDL_TRUE;
+}
+
+static void FOX_EndTarget(FOX_Font *font) {
+	SDL_Surface *surface = font->shared->target->surface;
+	for(int i = 0; i <= font->num_fallbacks; i++) {
+		FOX_ChainFont(font, i)->target = NULL;
+	}
+	if(SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+}
+
+/******************************************************************************
+ * Font rendering
+ *****************************************************************************/
+
+/* Sets the vertex color of the quads queued for a font and its fallbacks. */
+static void FOX_SetBatchColor(FOX_Font *font, SDL_Color color) {
+	for(int i = 0; i <= font->num_fallbacks; i++) {
+		FOX_ChainFont(font, i)->color = color;
+	}
+}
+
+/* Starts a new batch using the current render draw color.
+ * The color is fetched once per batch instead of once per glyph. */
+static void FOX_BeginBatch(FOX_Font *font) {
+	SDL_Color color;
+	SDL_GetRenderDrawColor(font->shared->renderer, &color.r, &color.g,
+													&color.b, &color.a);
+	color.a = 255;
+	FOX_SetBatchColor(font, color);
+}
+
+/* Submits the queued glyph quads of a font with a single draw call per
+ * atlas page. */
+static void FOX_FlushPages(FOX_SharedFont *font) {
+	for(int i = 0; i < font->num_pages; i++) {
+		FOX_AtlasPage *page = &font->pages[i];
+		FOX_Batch *batch = &page->batch;
+		if(batch->count > 0) {
+			SDL_RenderGeometry(font->renderer, page->texture,
+				batch->vertices, batch->count * 4,
+				batch->indices, batch->count * 6);
+			FOX_COUNT(font, draw_calls, 1);
+			FOX_COUNT(font, glyphs_rendered, batch->count);
+			batch->count = 0;
+		}
+	}
+}
+
+/* Submits the queued glyph quads of a font and its fallbacks. */
+static void FOX_FlushBatch(FOX_Font *font) {
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_FlushPages(FOX_ChainFont(font, f));
+	}
+}
+
+/* Drops the glyph quads queued for a font and its fallbacks. */
+static void FOX_DiscardBatch(FOX_Font *font) {
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		for(int i = 0; i < chain->num_pages; i++) {
+			chain->pages[i].batch.count = 0;
+		}
+	}
+}
+
+/* Keeps the atlas pages of a font and its fallbacks used from now on from
+ * being evicted until they are unpinned again. */
+static void FOX_PinPages(FOX_Font *font, SDL_bool pin) {
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		chain->pinned = pin ? chain->clock + 1 : 0;
+	}
+}
+
+/* Marks the atlas pages drawn from by the runs of retained text as used,
+ * so that their glyphs are evicted last. Only fonts with an atlas budget
+ * keep track of this. */
+static void FOX_TouchPages(FOX_Font *font, SDL_Texture *const *textures,
+								const FOX_Batch *runs, int num_runs
+) {
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		if(chain->max_pages == 0) continue;
+		for(int i = 0; i < chain->num_pages; i++) {
+			FOX_AtlasPage *page = &chain->pages[i];
+			for(int r = 0; r < num_runs; r++) {
+				if(runs[r].count > 0 && textures[r] == page->texture) {
+					page->last_used = ++chain->clock;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* Grows the batch buffers, so that at least one more quad fits. */
+static SDL_bool FOX_GrowBatch(FOX_Batch *batch) {
+	int capacity = batch->capacity ? batch->capacity * 2 : 64;
+
+	SDL_Vertex *vertices = SDL_realloc(batch->vertices,
+									sizeof(*vertices) * capacity * 4);
+	if(!vertices) return SDL_FALSE;
+	batch->vertices = vertices;
+
+	int *indices = SDL_realloc(batch->indices, sizeof(*indices) * capacity * 6);
+	if(!indices) return SDL_FALSE;
+	batch->indices = indices;
+
+	/* Two triangles per quad: top-left, top-right, bottom-left and
+	 * bottom-left, top-right, bottom-right */
+	for(int i = batch->capacity; i < capacity; i++) {
+		int *quad = &indices[i * 6];
+		quad[0] = i * 4;
+		quad[1] = i * 4 + 1;
+		quad[2] = i * 4 + 2;
+		quad[3] = i * 4 + 2;
+		quad[4] = i * 4 + 1;
+		quad[5] = i * 4 + 3;
+	}
+
+	batch->capacity = capacity;
+	return SDL_TRUE;
+}
+
+/* Queues the atlas region of a glyph to be drawn at the given rect. */
+static void FOX_BatchQuad(FOX_SharedFont *font, const FOX_Glyph *glyph,
+											const SDL_Rect *dst
+) {
+	FOX_AtlasPage *page = &font->pages[glyph->page];
+	page->last_used = ++font->clock;
+	if(font->target) {
+		/* Surface fonts draw right away instead */
+		FOX_BlendGlyph(font->target, page, &glyph->metrics.rect, dst);
+		FOX_COUNT(font, glyphs_rendered, 1);
+		return;
+	}
+
+	FOX_Batch *batch = &page->batch;
+	if(batch->count == batch->capacity && !FOX_GrowBatch(batch)) {
+		/* Out of memory; submit what we have and reuse the buffers */
+		FOX_FlushPages(font);
+		if(batch->capacity == 0) return;
+	}
+
+	const SDL_Rect *src = &glyph->metrics.rect;
+	float u0 = (float)src->x / page->w;
+	float v0 = (float)src->y / page->h;
+	float u1 = (float)(src->x + src->w) / page->w;
+	float v1 = (float)(src->y + src->h) / page->h;
+	float x0 = (float)dst->x;
+	float y0 = (float)dst->y;
+	float x1 = (float)(dst->x + dst->w);
+	float y1 = (float)(dst->y + dst->h);
+
+	SDL_Vertex *vertex = &batch->vertices[batch->count * 4];
+	vertex[0] = (SDL_Vertex){{x0, y0}, font->color, {u0, v0}};
+	vertex[1] = (SDL_Vertex){{x1, y0}, font->color, {u1, v0}};
+	vertex[2] = (SDL_Vertex){{x0, y1}, font->color, {u0, v1}};
+	vertex[3] = (SDL_Vertex){{x1, y1}, font->color, {u1, v1}};
+	batch->count++;
+}
+
+/* Queues a character at the given position and returns its advance.
+ * Counterpart to FOX_RenderChar() that does not issue a draw call. */
+static int FOX_BatchChar(FOX_Font *font, Uint32 ch, Uint32 previous_ch,
+											const SDL_Point *position
+) {
+	int advance = 0;
+	FOX_SharedFont *owner;
+	const FOX_Glyph *glyph = FOX_ResolveGlyph(font, ch, &owner);
+	if(glyph) {
+		const FOX_GlyphMetrics *metrics = &glyph->metrics;
+		SDL_Rect dstrect;
+
+		/* Glyphs of fallback fonts share the baseline of the font */
+		dstrect.x = position->x;
+		dstrect.y = position->y - metrics->bearing.y
+									+ font->shared->size.height;
+		dstrect.w = metrics->rect.w;
+		dstrect.h = metrics->rect.h;
+
+		if(previous_ch) {
+			advance += FOX_GetKerningOffset(font, ch, previous_ch);
+			dstrect.x += advance;
+		}
+
+		if(dstrect.w > 0 && dstrect.h > 0) {
+			FOX_BatchQuad(owner, glyph, &dstrect);
+		}
+		advance += metrics->advance;
+	}
+
+	return advance;
+}
+
+/*****************************************************************************/
+
+/* Tab stops are placed every FOX_TAB_SIZE spaces */
+#define FOX_TAB_SIZE 4
+
+/* Returns the distance from x to the next tab stop of a line. */
+static int FOX_TabAdvance(FOX_Font *font, int x) {
+	const FOX_GlyphMetrics *space = FOX_QueryGlyphMetrics(font, ' ');
+	int stop = FOX_TAB_SIZE
+			* (space ? space->advance : font->shared->size.ptsize);
+	if(stop <= 0) return 0;
+	return stop - x % stop;
+}
+
+/* Breaks off the next line of a text that is at most width pixels wide
+ * (unlimited if width <= 0), scanning every character once. Lines end at
+ * newlines or before the last word that overflows; words wider than a
+ * line are broken between characters. The end of the text is passed on
+ * to FOX_StartReader(), NULL if not known. Returns the start of the next
+ * line.
+ */
+static const Uint8* FOX_BreakLine(FOX_Font *font, const Uint8 *text,
+					const Uint8 *text_end, int width, FOX_Line *line
+) {
+	Uint64 start = FOX_TIMESTAMP();
+	const Uint8 *end = text;	/* end of the last visible character */
+	const Uint8 *word = NULL;	/* start of the last word after whitespace */
+	const Uint8 *word_end = text;	/* end of the line before that word */
+	int word_x = 0;
+	SDL_bool after_space = SDL_FALSE;
+	Uint32 previous_ch = 0;
+	int x = 0, end_x = 0;
+
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, text_end);
+	const Uint8 *next = text;
+	for(const Uint8 *p = text;; p = next) {
+		Uint32 ch;
+		if(!FOX_ReadChar(&reader, &ch)) break;
+		next = reader.text;
+
+		if(ch == '\n') {
+			break;
+		} else if(ch == '\r') {
+			continue;
+		} else if(ch == ' ' || ch == '\t') {
+			x += ch == ' ' ? FOX_GetAdvance(font, ch, previous_ch)
+							: FOX_TabAdvance(font, x);
+			previous_ch = ch == ' ' ? ch : 0;
+			after_space = SDL_TRUE;
+			continue;
+		}
+
+		int advance = FOX_GetAdvance(font, ch, previous_ch);
+		if(width > 0 && x + advance > width && end != text) {
+			if(after_space) {
+				/* Wrap before the current word */
+				next = p;
+			} else if(word) {
+				/* Wrap before the word containing the current character */
+				end = word_end;
+				end_x = word_x;
+				next = word;
+			} else {
+				/* The word does not fit on a line by itself */
+				next = p;
+			}
+			break;
+		}
+
+		if(after_space) {
+			word = p;
+			word_end = end;
+			word_x = end_x;
+			after_space = SDL_FALSE;
+		}
+		x += advance;
+		previous_ch = ch;
+		end = next;
+		end_x = x;
+	}
+
+	line->offset = 0;
+	line->length = end - text;
+	line->width = end_x;
+	FOX_COUNT(font->shared, lines_laid_out, 1);
+	FOX_TIME(font->shared, layout_ticks, start);
+	return next;
+}
+
+/* Queues the characters of a line laid out by FOX_BreakLine(). At most n
+ * characters are queued unless n is negative, the count of characters
+ * queued is subtracted from n. Returns the first character not queued. */
+static const Uint8* FOX_BatchLine(FOX_Font *font, const Uint8 *text,
+				const Uint8 *end, const SDL_Point *position, int *n
+) {
+	SDL_Point cursor = *position;
+	Uint32 previous_ch = 0;
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, end);
+	Uint32 ch;
+	while(*n != 0 && FOX_ReadChar(&reader, &ch)) {
+		if(ch == '\r') {
+			continue;
+		} else if(ch == '\t') {
+			cursor.x += FOX_TabAdvance(font, cursor.x - position->x);
+			previous_ch = 0;
+		} else {
+			cursor.x += FOX_BatchChar(font, ch, previous_ch, &cursor);
+			previous_ch = ch;
+		}
+		if(*n > 0) (*n)--;
+	}
+	return reader.text;
+}
+
+int FOX_LayoutText(FOX_Font *font, const Uint8 *text, int width,
+			FOX_Line *lines, int max_lines, const Uint8 **endptr
+) {
+	const Uint8 *start = text;
+	int count = 0;
+	if(!FOX_FontReady(font)) max_lines = 0;
+	/* Only max_lines are laid out, so the rest of the text, which may be
+	 * long, is not scanned for its end */
+	for(; *text && count < max_lines; count++) {
+		const Uint8 *line = text;
+		text = FOX_BreakLine(font, line, NULL, width, &lines[count]);
+		lines[count].offset = line - start;
+	}
+
+	if(endptr) *endptr = text;
+	return count;
+}
+
+/*****************************************************************************/
+
+int FOX_RenderChar(FOX_Font *font, Uint32 ch, Uint32 previous_ch,
+										const SDL_Point *position
+) {
+	if(!FOX_FontReady(font)) return 0;
+	FOX_BeginBatch(font);
+	int advance = FOX_BatchChar(font, ch, previous_ch, position);
+	FOX_FlushBatch(font);
+	return advance;
+}
+
+/* Queues a utf-8 string of text at the given position. */
+static void FOX_BatchText(FOX_Font *font, const Uint8 *text,
+							const SDL_Point *position
+) {
+	SDL_Point cursor = *position;
+	Uint32 previous_ch = 0;
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, text + SDL_strlen((const char*)text));
+	Uint32 ch;
+	while(FOX_ReadChar(&reader, &ch)) {
+		if(ch == '\n') {
+			cursor.x = position->x;
+			cursor.y += font->shared->size.height;
+			previous_ch = 0;
+			continue;
+		} else if(ch == '\r') {
+			continue;
+		} else if(ch == '\t') {
+			cursor.x += FOX_TabAdvance(font, cursor.x - position->x);
+			previous_ch = 0;
+		} else {
+			cursor.x += FOX_BatchChar(font, ch, previous_ch, &cursor);
+			previous_ch = ch;
+		}
+	}
+}
+
+/* Queues as many lines of text as fit inside the given rect, see
+ * FOX_RenderTextInside(). */
+static int FOX_BatchTextInside(FOX_Font *font, const Uint8 *text,
+			const Uint8 **endptr, const SDL_Rect *rect, int n
+) {
+	int state = 0;
+	unsigned linesAvailable = rect->h / font->shared->size.height;
+	if(linesAvailable == 0) {
+		return -1;
+	}
+
+	SDL_Point cursor = {rect->x, rect->y};
+	for(unsigned i = 0; i < linesAvailable && *text; i++) {
+		FOX_Line line;
+		const Uint8 *next = FOX_BreakLine(font, text, NULL, rect->w, &line);
+		const Uint8 *end = FOX_BatchLine(font, text, text + line.length,
+													&cursor, &n);
+		if(n == 0) {
+			/* Continue at the next line if all of this one was printed */
+			text = end == text + line.length ? next : end;
+			state = 1;
+			break;
+		}
+
+		text = next;
+		cursor.y += font->shared->size.height;
+	}
+
+	if(*text != '\0') {
+		*endptr = text;
+		return state + 1;
+	} else {
+		*endptr = NULL;
+		return 0;
+	}
+}
+
+void FOX_RenderText(FOX_Font *font, const Uint8 *text,
+							const SDL_Point *position
+) {
+	if(!FOX_FontReady(font)) return;
+	FOX_BeginBatch(font);
+	FOX_BatchText(font, text, position);
+	FOX_FlushBatch(font);
+}
+
+/* Returns the font a style renders with, the given font if the style
+ * has none or its font has not finished loading. */
+static FOX_Font* FOX_StyleFont(FOX_Font *font, const FOX_Style *style) {
+	if(style && style->font && FOX_FontReady(style->font)) {
+		return style->font;
+	}
+	return font;
+}
+
+void FOX_RenderStyledText(FOX_Font *font, const Uint8 *text,
+					const FOX_Style *styles, int num_styles,
+					const SDL_Point *position
+) {
+	if(!FOX_FontReady(font)) return;
+	FOX_BeginBatch(font);
+	SDL_Color draw_color = font->shared->color;
+
+	const Uint8 *start = text;
+	SDL_Point cursor = *position;
+	Uint32 previous_ch = 0;
+	FOX_Font *previous_font = font;
+	const FOX_Style *current = NULL;
+	int s = 0;
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, text + SDL_strlen((const char*)text));
+	Uint32 ch;
+	for(; FOX_ReadChar(&reader, &ch); text = reader.text) {
+		/* Find the style of the character; styles are sorted by offset */
+		size_t offset = (size_t)(text - start);
+		while(s < num_styles
+			&& offset >= styles[s].offset + styles[s].length
+		) {
+			s++;
+		}
+		const FOX_Style *style = s < num_styles
+			&& offset >= styles[s].offset ? &styles[s] : NULL;
+		FOX_Font *style_font = FOX_StyleFont(font, style);
+		if(style != current) {
+			FOX_SetBatchColor(style_font, style ? style->color : draw_color);
+			current = style;
+		}
+
+		if(ch == '\n') {
+			cursor.x = position->x;
+			cursor.y += font->shared->size.height;
+			previous_ch = 0;
+			continue;
+		} else if(ch == '\r') {
+			continue;
+		} else if(ch == '\t') {
+			cursor.x += FOX_TabAdvance(font, cursor.x - position->x);
+			previous_ch = 0;
+			continue;
+		}
+
+		/* Kerning only applies between characters of the same font, and
+		 * fonts of other sizes share the baseline of the font */
+		if(style_font != previous_font) previous_ch = 0;
+		SDL_Point point = {cursor.x,
+				cursor.y + font->shared->size.height
+						- style_font->shared->size.height};
+		cursor.x += FOX_BatchChar(style_font, ch, previous_ch, &point);
+		previous_ch = ch;
+		previous_font = style_font;
+	}
+
+	FOX_FlushBatch(font);
+	for(int i = 0; i < num_styles; i++) {
+		FOX_Font *style_font = FOX_StyleFont(font, &styles[i]);
+		if(style_font != font) FOX_FlushBatch(style_font);
+	}
+}
+
+int FOX_RenderTextInside(FOX_Font *font, const Uint8 *text,
+			const Uint8 **endptr, const SDL_Rect *rect, int n
+) {
+	#ifdef FOX_DEBUG
+	{
+		SDL_Color rc;
+		SDL_Renderer *renderer = font->shared->renderer;
+		SDL_GetRenderDrawColor(renderer, &rc.r, &rc.g, &rc.b, &rc.a);
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+		SDL_RenderDrawRect(renderer, rect);
+		SDL_SetRenderDrawColor(renderer, rc.r, rc.g, rc.b, rc.a);
+	}
+	#endif
+
+	if(!FOX_FontReady(font)) return -1;
+	FOX_BeginBatch(font);
+	int state = FOX_BatchTextInside(font, text, endptr, rect, n);
+	FOX_FlushBatch(font);
+	return state;
+}
+
+void FOX_RenderAtlas(FOX_Font *font, SDL_Point *pos) {
+	if(!FOX_FontReady(font)) return;
+
+	/* Pages are laid out next to each other */
+	FOX_SharedFont *shared = font->shared;
+	SDL_Rect dstrect = {pos->x, pos->y, 0, 0};
+	for(int i = 0; i < shared->num_pages; i++) {
+		dstrect.w = shared->pages[i].w;
+		dstrect.h = shared->pages[i].h;
+		SDL_RenderCopy(shared->renderer, shared->pages[i].texture, NULL,
+																&dstrect);
+		FOX_COUNT(shared, draw_calls, 1);
+		dstrect.x += dstrect.w;
+	}
+}
+
+/*****************************************************************************/
+
+void FOX_RenderTextToSurface(FOX_Font *font, SDL_Surface *surface,
+		const Uint8 *text, const SDL_Point *position, SDL_Color color
+) {
+	FOX_Target target;
+	if(!FOX_BeginTarget(font, &target, surface, color)) return;
+	FOX_BatchText(font, text, position);
+	FOX_EndTarget(font);
+}
+
+int FOX_RenderTextInsideSurface(FOX_Font *font, SDL_Surface *surface,
+				const Uint8 *text, const Uint8 **endptr,
+				const SDL_Rect *rect, int n, SDL_Color color
+) {
+	FOX_Target target;
+	if(!FOX_BeginTarget(font, &target, surface, color)) return -1;
+	int state = FOX_BatchTextInside(font, text, endptr, rect, n);
+	FOX_EndTarget(font);
+	return state;
+}
+
+/******************************************************************************
+ * Retained text
+ *****************************************************************************/
+
+struct FOX_Text {
+	FOX_Font *font;
+	Uint8 *string;			/* copy of the utf-8 text */
+	int wrap_width;			/* 0 if lines are not wrapped */
+	FOX_Batch *runs;		/* quads of the text for each atlas page */
+	SDL_Texture **textures;	/* atlas page of each run */
+	int num_runs;
+	SDL_Point origin;		/* position the quads are currently placed at */
+	SDL_Color color;
+	SDL_Color vertex_color;	/* color the quads currently have */
+	int w, h;
+	SDL_bool dirty;			/* layout has to be redone before rendering */
+	Uint64 generation;		/* of the layout, see FOX_LayoutGeneration() */
+};
+
+/* Takes over the quads queued for a font and its fallbacks, one run per
+ * atlas page, including pages and fallbacks added while queueing. The
+ * batches of the font are left empty for the next time. */
+static SDL_bool FOX_TakeBatches(FOX_Font *font, FOX_Batch **runs,
+								SDL_Texture ***textures, int *num_runs
+) {
+	int num_pages = 0;
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		num_pages += FOX_ChainFont(font, f)->num_pages;
+	}
+
+	if(*num_runs < num_pages) {
+		FOX_Batch *grown = SDL_realloc(*runs, sizeof(**runs) * num_pages);
+		if(grown) *runs = grown;
+		SDL_Texture **grown_textures = SDL_realloc(*textures,
+										sizeof(**textures) * num_pages);
+		if(grown_textures) *textures = grown_textures;
+		if(!grown || !grown_textures) {
+			FOX_DiscardBatch(font);
+			return SDL_FALSE;
+		}
+		SDL_memset(&grown[*num_runs], 0,
+				sizeof(*grown) * (num_pages - *num_runs));
+		*num_runs = num_pages;
+	}
+
+	int r = 0;
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		for(int i = 0; i < chain->num_pages; i++, r++) {
+			FOX_Batch run = (*runs)[r];
+			run.count = 0;
+			(*runs)[r] = chain->pages[i].batch;
+			(*textures)[r] = chain->pages[i].texture;
+			chain->pages[i].batch = run;
+		}
+	}
+	for(; r < *num_runs; r++) {
+		(*runs)[r].count = 0;
+	}
+	return SDL_TRUE;
+}
+
+/* Lays out the text at (0, 0) by queueing its quads into the batches of
+ * the font, then takes over the queued quads. */
+static SDL_bool FOX_UpdateText(FOX_Text *text) {
+	FOX_Font *font = text->font;
+	if(!text->dirty && text->generation == FOX_LayoutGeneration(font)) {
+		return SDL_TRUE;
+	}
+	if(!FOX_FontReady(font)) return SDL_FALSE;
+
+	FOX_SetBatchColor(font, text->color);
+	SDL_Point cursor = {0, 0};
+	int lines = 0;
+	text->w = 0;
+	const Uint8 *end = text->string + SDL_strlen((const char*)text->string);
+	for(const Uint8 *string = text->string; *string; lines++) {
+		FOX_Line line;
+		const Uint8 *next = FOX_BreakLine(font, string, end,
+											text->wrap_width, &line);
+		int n = -1;
+		FOX_BatchLine(font, string, string + line.length, &cursor, &n);
+		text->w = SDL_max(text->w, line.width);
+		cursor.y += font->shared->size.height;
+		string = next;
+	}
+
+	if(!FOX_TakeBatches(font, &text->runs, &text->textures,
+											&text->num_runs)
+	) {
+		return SDL_FALSE;
+	}
+
+	text->h = lines * font->shared->size.height;
+	text->origin = (SDL_Point){0, 0};
+	text->vertex_color = text->color;
+	text->dirty = SDL_FALSE;
+	text->generation = FOX_LayoutGeneration(font);
+	return SDL_TRUE;
+}
+
+FOX_Text* FOX_CreateText(FOX_Font *font, const Uint8 *string) {
+	FOX_Text *text = SDL_calloc(1, sizeof(*text));
+	if(!text) return NULL;
+
+	text->string = (Uint8*)SDL_strdup((const char*)string);
+	if(!text->string) {
+		SDL_free(text);
+		return NULL;
+	}
+
+	text->font = font;
+	text->color = (SDL_Color){255, 255, 255, 255};
+	text->dirty = SDL_TRUE;
+	return text;
+}
+
+void FOX_DestroyText(FOX_Text *text) {
+	if(!text) return;
+	for(int i = 0; i < text->num_runs; i++) {
+		SDL_free(text->runs[i].vertices);
+		SDL_free(text->runs[i].indices);
+	}
+	SDL_free(text->runs);
+	SDL_free(text->textures);
+	SDL_free(text->string);
+	SDL_free(text);
+}
+
+SDL_bool FOX_SetTextString(FOX_Text *text, const Uint8 *string) {
+	if(SDL_strcmp((const char*)text->string, (const char*)string) == 0) {
+		return SDL_TRUE;
+	}
+
+	Uint8 *copy = (Uint8*)SDL_strdup((const char*)string);
+	if(!copy) return SDL_FALSE;
+	SDL_free(text->string);
+	text->string = copy;
+	text->dirty = SDL_TRUE;
+	return SDL_TRUE;
+}
+
+void FOX_SetTextFont(FOX_Text *text, FOX_Font *font) {
+	if(text->font != font) {
+		text->font = font;
+		text->dirty = SDL_TRUE;
+	}
+}
+
+void FOX_SetTextWrapWidth(FOX_Text *text, int width) {
+	width = SDL_max(width, 0);
+	if(text->wrap_width != width) {
+		text->wrap_width = width;
+		text->dirty = SDL_TRUE;
+	}
+}
+
+void FOX_SetTextColor(FOX_Text *text, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
+	text->color = (SDL_Color){r, g, b, a};
+}
+
+void FOX_QueryTextSize(FOX_Text *text, int *w, int *h) {
+	if(!FOX_UpdateText(text)) {
+		if(w) *w = 0;
+		if(h) *h = 0;
+		return;
+	}
+	if(w) *w = text->w;
+	if(h) *h = text->h;
+}
+
+void FOX_RenderTextObject(FOX_Text *text, const SDL_Point *position) {
+	if(!FOX_UpdateText(text)) return;
+
+	/* Move and recolor the quads only if anything changed */
+	float dx = (float)(position->x - text->origin.x);
+	float dy = (float)(position->y - text->origin.y);
+	SDL_bool recolor = SDL_memcmp(&text->color, &text->vertex_color,
+											sizeof(text->color)) != 0;
+
+	FOX_Font *font = text->font;
+	for(int i = 0; i < text->num_runs; i++) {
+		FOX_Batch *run = &text->runs[i];
+		if(run->count == 0) continue;
+
+		if(dx != 0.0f || dy != 0.0f || recolor) {
+			for(int v = 0; v < run->count * 4; v++) {
+				run->vertices[v].position.x += dx;
+				run->vertices[v].position.y += dy;
+				run->vertices[v].color = text->color;
+			}
+		}
+
+		SDL_RenderGeometry(font->shared->renderer, text->textures[i],
+			run->vertices, run->count * 4, run->indices, run->count * 6);
+		FOX_COUNT(font->shared, draw_calls, 1);
+		FOX_COUNT(font->shared, glyphs_rendered, run->count);
+	}
+
+	FOX_TouchPages(font, text->textures, text->runs, text->num_runs);
+	text->origin = *position;
+	text->vertex_color = text->color;
+}
+
+/******************************************************************************
+ * Text reveal
+ *****************************************************************************/
+
+/* Characters without a quad, e.g. spaces, tabs and missing characters */
+#define FOX_REVEAL_NONE 0xFFFFFFFFu
+
+struct FOX_Reveal {
+	FOX_Font *font;
+	Uint8 *string;			/* copy of the utf-8 text */
+	const Uint8 *end;		/* end of the string */
+	SDL_Rect rect;
+	const Uint8 *page;		/* start of the current page */
+	const Uint8 *next;		/* start of the next page, NULL if last */
+	FOX_Batch *runs;		/* quads of the page for each atlas page */
+	SDL_Texture **textures;	/* atlas page of each run */
+	int *shown;				/* number of quads revealed of each run */
+	int num_runs;
+	Uint32 *chars;			/* run of the quad of each character */
+	int num_chars;
+	int capacity;			/* of chars */
+	int revealed;			/* number of characters revealed */
+	float pending;			/* fraction of a character to reveal next */
+	SDL_Color vertex_color;	/* color the quads currently have */
+	int state;				/* enum FOX_PrintState of the page */
+	SDL_bool dirty;			/* page has to be laid out before revealing */
+	Uint64 generation;		/* of the layout, see FOX_LayoutGeneration() */
+};
+
+/* Appends the run of a character, encoded as fallback and page index
+ * until the runs are known. */
+static SDL_bool FOX_AddRevealChar(FOX_Reveal *reveal, Uint32 run) {
+	if(reveal->num_chars == reveal->capacity) {
+		int capacity = reveal->capacity ? reveal->capacity * 2 : 256;
+		Uint32 *chars = SDL_realloc(reveal->chars, sizeof(*chars) * capacity);
+		if(!chars) return SDL_FALSE;
+		reveal->chars = chars;
+		reveal->capacity = capacity;
+	}
+	reveal->chars[reveal->num_chars++] = run;
+	return SDL_TRUE;
+}
+
+/* Queues the characters of a line like FOX_BatchLine() and notes which
+ * atlas page the quad of each character has been queued for. */
+static SDL_bool FOX_RevealLine(FOX_Reveal *reveal, const Uint8 *text,
+						const Uint8 *end, const SDL_Point *position
+) {
+	FOX_Font *font = reveal->font;
+	SDL_Point cursor = *position;
+	Uint32 previous_ch = 0;
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, end);
+	Uint32 ch;
+	while(FOX_ReadChar(&reader, &ch)) {
+		Uint32 run = FOX_REVEAL_NONE;
+		if(ch == '\r') {
+			continue;
+		} else if(ch == '\t') {
+			cursor.x += FOX_TabAdvance(font, cursor.x - position->x);
+			previous_ch = 0;
+		} else {
+			/* Only glyphs with pixels are queued, see FOX_BatchChar() */
+			FOX_SharedFont *owner;
+			const FOX_Glyph *glyph = FOX_ResolveGlyph(font, ch, &owner);
+			if(glyph && glyph->metrics.rect.w > 0
+				&& glyph->metrics.rect.h > 0
+			) {
+				int f = 0;
+				while(FOX_ChainFont(font, f) != owner) f++;
+				run = (Uint32)f << 16 | glyph->page;
+			}
+			cursor.x += FOX_BatchChar(font, ch, previous_ch, &cursor);
+			previous_ch = ch;
+		}
+		if(!FOX_AddRevealChar(reveal, run)) return SDL_FALSE;
+	}
+	return SDL_TRUE;
+}
+
+/* Reveals the quads of characters first to last (exclusive). */
+static void FOX_ShowChars(FOX_Reveal *reveal, int first, int last) {
+	for(int i = first; i < last; i++) {
+		if(reveal->chars[i] != FOX_REVEAL_NONE) {
+			reveal->shown[reveal->chars[i]]++;
+		}
+	}
+}
+
+/* Lays out the current page once by queueing the quads of all of its
+ * characters, like FOX_RenderTextInside() does, and takes them over.
+ * Characters revealed so far stay revealed. */
+static SDL_bool FOX_UpdateReveal(FOX_Reveal *reveal) {
+	FOX_Font *font = reveal->font;
+	if(!reveal->dirty && reveal->generation == FOX_LayoutGeneration(font)) {
+		return SDL_TRUE;
+	}
+	if(!FOX_FontReady(font)) return SDL_FALSE;
+
+	int lines = reveal->rect.h / font->shared->size.height;
+	reveal->num_chars = 0;
+	reveal->next = NULL;
+	reveal->state = FOX_ERROR;
+	reveal->dirty = SDL_FALSE;
+	reveal->generation = FOX_LayoutGeneration(font);
+	if(lines <= 0) return SDL_TRUE;
+
+	FOX_SetBatchColor(font, reveal->vertex_color);
+	const Uint8 *text = reveal->page;
+	SDL_Point cursor = {reveal->rect.x, reveal->rect.y};
+	SDL_bool laid_out = SDL_TRUE;
+	for(int i = 0; i < lines && *text && laid_out; i++) {
+		FOX_Line line;
+		const Uint8 *next = FOX_BreakLine(font, text, reveal->end,
+											reveal->rect.w, &line);
+		laid_out = FOX_RevealLine(reveal, text, text + line.length, &cursor);
+		text = next;
+		cursor.y += font->shared->size.height;
+	}
+
+	/* Quads are only ever appended, so the quads revealed of each run
+	 * are the first ones */
+	if(!FOX_TakeBatches(font, &reveal->runs, &reveal->textures,
+										&reveal->num_runs)
+		|| !laid_out
+	) {
+		reveal->dirty = SDL_TRUE;
+		return SDL_FALSE;
+	}
+	int *shown = SDL_realloc(reveal->shown,
+							sizeof(*shown) * SDL_max(reveal->num_runs, 1));
+	if(!shown) {
+		reveal->dirty = SDL_TRUE;
+		return SDL_FALSE;
+	}
+	reveal->shown = shown;
+	SDL_memset(shown, 0, sizeof(*shown) * reveal->num_runs);
+
+	/* Turn fallback and page indices into run indices */
+	int base[FOX_MAX_FALLBACKS + 1];
+	for(int f = 0, r = 0; f <= font->num_fallbacks; f++) {
+		base[f] = r;
+		r += FOX_ChainFont(font, f)->num_pages;
+	}
+	for(int i = 0; i < reveal->num_chars; i++) {
+		Uint32 run = reveal->chars[i];
+		if(run != FOX_REVEAL_NONE) {
+			reveal->chars[i] = base[run >> 16] + (run & 0xFFFF);
+		}
+	}
+
+	/* Glyphs evicted while laying out the page were not on it */
+	reveal->generation = FOX_LayoutGeneration(font);
+	reveal->next = *text ? text : NULL;
+	reveal->revealed = SDL_min(reveal->revealed, reveal->num_chars);
+	FOX_ShowChars(reveal, 0, reveal->revealed);
+	reveal->state = FOX_MORE_TEXT;
+	return SDL_TRUE;
+}
+
+/* Returns the state of the page, see enum FOX_PrintState. */
+static int FOX_RevealState(const FOX_Reveal *reveal) {
+	if(reveal->dirty || reveal->state == FOX_ERROR) return FOX_ERROR;
+	if(reveal->revealed < reveal->num_chars) return FOX_MORE_TEXT;
+	return reveal->next ? FOX_NEXT_PAGE : FOX_DONE_PRINTING;
+}
+
+FOX_Reveal* FOX_CreateReveal(FOX_Font *font, const Uint8 *string,
+											const SDL_Rect *rect
+) {
+	FOX_Reveal *reveal = SDL_calloc(1, sizeof(*reveal));
+	if(!reveal) return NULL;
+
+	reveal->string = (Uint8*)SDL_strdup((const char*)string);
+	if(!reveal->string) {
+		SDL_free(reveal);
+		return NULL;
+	}
+
+	reveal->font = font;
+	reveal->end = reveal->string + SDL_strlen((const char*)reveal->string);
+	reveal->rect = *rect;
+	reveal->page = reveal->string;
+	reveal->vertex_color = (SDL_Color){255, 255, 255, 255};
+	reveal->dirty = SDL_TRUE;
+	return reveal;
+}
+
+void FOX_DestroyReveal(FOX_Reveal *reveal) {
+	if(!reveal) return;
+	for(int i = 0; i < reveal->num_runs; i++) {
+		SDL_free(reveal->runs[i].vertices);
+		SDL_free(reveal->runs[i].indices);
+	}
+	SDL_free(reveal->runs);
+	SDL_free(reveal->textures);
+	SDL_free(reveal->shown);
+	SDL_free(reveal->chars);
+	SDL_free(reveal->string);
+	SDL_free(reveal);
+}
+
+int FOX_RevealChars(FOX_Reveal *reveal, int n) {
+	if(!FOX_UpdateReveal(reveal)) return FOX_ERROR;
+
+	int left = reveal->num_chars - reveal->revealed;
+	if(n < 0 || n > left) n = left;
+	FOX_ShowChars(reveal, reveal->revealed, reveal->revealed + n);
+	reveal->revealed += n;
+	return FOX_RevealState(reveal);
+}
+
+int FOX_RevealTime(FOX_Reveal *reveal, Uint32 ms, float chars_per_second) {
+	if(!FOX_UpdateReveal(reveal)) return FOX_ERROR;
+
+	/* Fractions of characters add up over calls within a page */
+	reveal->pending += ms * chars_per_second / 1000.0f;
+	int n = (int)reveal->pending;
+	reveal->pending -= n;
+	int state = FOX_RevealChars(reveal, n);
+	if(state != FOX_MORE_TEXT) reveal->pending = 0.0f;
+	return state;
+}
+
+int FOX_NextRevealPage(FOX_Reveal *reveal) {
+	if(!FOX_UpdateReveal(reveal)) return FOX_ERROR;
+
+	/* The last page is followed by the first one again */
+	reveal->page = reveal->next ? reveal->next : reveal->string;
+	reveal->revealed = 0;
+	reveal->pending = 0.0f;
+	reveal->dirty = SDL_TRUE;
+	if(!FOX_UpdateReveal(reveal)) return FOX_ERROR;
+	return FOX_RevealState(reveal);
+}
+
+int FOX_RenderReveal(FOX_Reveal *reveal) {
+	if(!FOX_UpdateReveal(reveal) || reveal->state == FOX_ERROR) {
+		return FOX_ERROR;
+	}
+
+	/* Like FOX_RenderTextInside(), use the render draw color; the quads
+	 * are only recolored when it changes */
+	FOX_Font *font = reveal->font;
+	SDL_Color color;
+	SDL_GetRenderDrawColor(font->shared->renderer, &color.r, &color.g, &color.b,
+															&color.a);
+	color.a = 255;
+	SDL_bool recolor = SDL_memcmp(&color, &reveal->vertex_color,
+											sizeof(color)) != 0;
+
+	for(int i = 0; i < reveal->num_runs; i++) {
+		FOX_Batch *run = &reveal->runs[i];
+		if(recolor) {
+			for(int v = 0; v < run->count * 4; v++) {
+				run->vertices[v].color = color;
+			}
+		}
+
+		int count = reveal->shown[i];
+		if(count == 0) continue;
+		SDL_RenderGeometry(font->shared->renderer, reveal->textures[i],
+					run->vertices, count * 4, run->indices, count * 6);
+		FOX_COUNT(font->shared, draw_calls, 1);
+		FOX_COUNT(font->shared, glyphs_rendered, count);
+	}
+
+	FOX_TouchPages(font, reveal->textures, reveal->runs, reveal->num_runs);
+	reveal->vertex_color = color;
+	return FOX_RevealState(reveal);
+}
+
+/******************************************************************************
+ * Cached text blocks
+ *****************************************************************************/
+
+/* Most blocks kept at once, including blocks seen only once so far */
+#define FOX_MAX_BLOCKS 256
+
+/* Text rendered inside a rect by FOX_RenderTextBlock(). Text seen for the
+ * first time is only remembered by its hash; it is drawn into a texture
+ * when it is rendered again, so text changing every frame never is. */
+struct FOX_Block {
+	FOX_Font *font;
+	Uint64 hash;			/* of the text */
+	size_t length;			/* bytes of the text */
+	Uint8 *string;			/* copy of the text once it has been drawn */
+	int w, h;				/* size of the rect */
+	SDL_Color color;
+	SDL_bool direct;		/* cannot be cached, always rendered directly */
+	SDL_Texture *texture;	/* NULL if there is nothing to draw */
+	SDL_Rect bounds;		/* of the texture relative to the rect */
+	int state;				/* returned by FOX_RenderTextInside() */
+	size_t end;				/* offset of *endptr inside the text */
+	Uint32 generation;		/* of the font when the texture was drawn */
+	int resets;				/* FOX_target_resets when it was drawn */
+	size_t bytes;			/* memory counted against the cache size */
+	FOX_Block *prev, *next;	/* more and less recently used blocks */
+};
+
+/* Counts the events telling that the contents of render target textures
+ * were lost. Called on the thread pushing the event. */
+static int SDLCALL FOX_WatchResets(void *userdata, SDL_Event *event) {
+	(void)userdata;
+	if(event->type == SDL_RENDER_TARGETS_RESET) {
+		SDL_AtomicAdd(&FOX_target_resets, 1);
+	}
+	return 0;
+}
+
+static void FOX_UnlinkBlock(FOX_Block *block) {
+	if(block->prev) block->prev->next = block->next;
+	else FOX_blocks = block->next;
+	if(block->next) block->next->prev = block->prev;
+	else FOX_blocks_tail = block->prev;
+	block->prev = block->next = NULL;
+}
+
+/* Inserts a block as the most recently used one. */
+static void FOX_PushBlock(FOX_Block *block) {
+	block->next = FOX_blocks;
+	if(FOX_blocks) FOX_blocks->prev = block;
+	else FOX_blocks_tail = block;
+	FOX_blocks = block;
+}
+
+static void FOX_FreeBlock(FOX_Block *block) {
+	FOX_UnlinkBlock(block);
+	FOX_num_blocks--;
+	FOX_block_bytes -= block->bytes;
+	if(block->texture) SDL_DestroyTexture(block->texture);
+	SDL_free(block->string);
+	SDL_free(block);
+}
+
+/* Frees the least recently used blocks, except for keep, until another
+ * count blocks fit into the cache. */
+static void FOX_TrimBlocks(int count, const FOX_Block *keep) {
+	FOX_Block *block = FOX_blocks_tail;
+	while(block && (FOX_block_bytes > FOX_block_cache_size
+					|| FOX_num_blocks + count > FOX_MAX_BLOCKS)
+	) {
+		FOX_Block *prev = block->prev;
+		if(block != keep) FOX_FreeBlock(block);
+		block = prev;
+	}
+}
+
+/* Sets the memory a block counts against the cache size. */
+static void FOX_ResizeBlock(FOX_Block *block, size_t bytes) {
+	FOX_block_bytes = FOX_block_bytes - block->bytes + bytes;
+	block->bytes = bytes;
+}
+
+static void FOX_PurgeBlocks(FOX_Font *font) {
+	FOX_Block *block = FOX_blocks;
+	while(block) {
+		FOX_Block *next = block->next;
+		if(block->font == font) FOX_FreeBlock(block);
+		block = next;
+	}
+}
+
+static FOX_Block* FOX_FindBlock(FOX_Font *font, const Uint8 *text,
+					size_t length, Uint64 hash, const SDL_Rect *rect,
+					SDL_Color color
+) {
+	for(FOX_Block *block = FOX_blocks; block; block = block->next) {
+		if(block->hash == hash && block->font == font
+			&& block->length == length
+			&& block->w == rect->w && block->h == rect->h
+			&& SDL_memcmp(&block->color, &color, sizeof(color)) == 0
+			&& (!block->string
+				|| SDL_memcmp(block->string, text, length) == 0)
+		) {
+			return block;
+		}
+	}
+	return NULL;
+}
+
+/* Remembers text seen for the first time, without drawing it. */
+static void FOX_AddBlock(FOX_Font *font, size_t length, Uint64 hash,
+								const SDL_Rect *rect, SDL_Color color
+) {
+	FOX_TrimBlocks(1, NULL);
+	FOX_Block *block = SDL_calloc(1, sizeof(*block));
+	if(!block) return;
+
+	block->font = font;
+	block->hash = hash;
+	block->length = length;
+	block->w = rect->w;
+	block->h = rect->h;
+	block->color = color;
+	FOX_PushBlock(block);
+	FOX_num_blocks++;
+	FOX_ResizeBlock(block, sizeof(*block));
+}
 
-static int FOX_Utf8Length(const unsigned char ch) {
-	int len = 0;
+/* Stops caching a block, e.g. because it is larger than the cache. */
+static void FOX_UncacheBlock(FOX_Block *block) {
+	if(block->texture) SDL_DestroyTexture(block->texture);
+	block->texture = NULL;
+	SDL_free(block->string);
+	block->string = NULL;
+	block->direct = SDL_TRUE;
+	FOX_ResizeBlock(block, sizeof(*block));
+}
 
-	for(FOX_Utf8 **u = FOX_utf; *u; ++u) {
-		if((ch & ~(*u)->mask) == (*u)->lead) {
-			break;
+/* Computes the bounding box of the quads queued for a font and its
+ * fallbacks and moves them to its top left corner. */
+static void FOX_BatchBounds(FOX_Font *font, SDL_Rect *bounds) {
+	float x0 = 0.0f, y0 = 0.0f, x1 = 0.0f, y1 = 0.0f;
+	SDL_bool empty = SDL_TRUE;
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		for(int i = 0; i < chain->num_pages; i++) {
+			const FOX_Batch *batch = &chain->pages[i].batch;
+			for(int v = 0; v < batch->count * 4; v++) {
+				SDL_FPoint p = batch->vertices[v].position;
+				if(empty || p.x < x0) x0 = p.x;
+				if(empty || p.y < y0) y0 = p.y;
+				if(empty || p.x > x1) x1 = p.x;
+				if(empty || p.y > y1) y1 = p.y;
+				empty = SDL_FALSE;
+			}
 		}
-		++len;
 	}
-	if(len > 4) { /* Malformed leading byte */
-		return -1;
+
+	bounds->x = (int)SDL_floor(x0);
+	bounds->y = (int)SDL_floor(y0);
+	bounds->w = (int)SDL_ceil(x1) - bounds->x;
+	bounds->h = (int)SDL_ceil(y1) - bounds->y;
+	for(int f = 0; f <= font->num_fallbacks; f++) {
+		FOX_SharedFont *chain = FOX_ChainFont(font, f);
+		for(int i = 0; i < chain->num_pages; i++) {
+			FOX_Batch *batch = &chain->pages[i].batch;
+			for(int v = 0; v < batch->count * 4; v++) {
+				batch->vertices[v].position.x -= (float)bounds->x;
+				batch->vertices[v].position.y -= (float)bounds->y;
+			}
+		}
 	}
-	return len;
 }
 
-static Uint32 FOX_Utf8Decode(const Uint8* sequence, const Uint8** endptr) {
-	int bytes = FOX_Utf8Length(*sequence);
-	int shift = FOX_utf[0]->bits_stored * (bytes - 1);
-	Uint32 codep = (*sequence++ & FOX_utf[bytes]->mask) << shift;
+/* Submits the queued glyph quads into a render target texture cleared
+ * to the given color, leaving the render target, viewport, clip rect,
+ * scale and draw color of the renderer as they were. */
+static SDL_bool FOX_FlushBatchInto(FOX_Font *font, SDL_Texture *texture,
+											SDL_Color color
+) {
+	SDL_Renderer *renderer = font->shared->renderer;
+	SDL_Texture *target = SDL_GetRenderTarget(renderer);
+	SDL_Rect viewport, clip;
+	SDL_bool clipped = SDL_RenderIsClipEnabled(renderer);
+	float scale_x, scale_y;
+	SDL_Color draw;
+	SDL_RenderGetViewport(renderer, &viewport);
+	SDL_RenderGetClipRect(renderer, &clip);
+	SDL_RenderGetScale(renderer, &scale_x, &scale_y);
+	SDL_GetRenderDrawColor(renderer, &draw.r, &draw.g, &draw.b, &draw.a);
+	if(SDL_SetRenderTarget(renderer, texture) != 0) return SDL_FALSE;
 
-	for(int i = 1; i < bytes; ++i, ++sequence) {
-		shift -= FOX_utf[0]->bits_stored;
-		codep |= ((char)*sequence & FOX_utf[0]->mask) << shift;
-	}
+	/* All glyphs have the same color. Clearing to it with zero alpha
+	 * lets blending leave the color as is, so that only the alpha holds
+	 * the coverage and the edges do not darken when the texture is
+	 * blended in turn. */
+	SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 0);
+	SDL_RenderClear(renderer);
+	FOX_FlushBatch(font);
 
-	*endptr = sequence-1;
-	return(codep);
+	/* SDL restores the state of the default target by itself */
+	SDL_SetRenderTarget(renderer, target);
+	if(target) {
+		SDL_RenderSetViewport(renderer, &viewport);
+		SDL_RenderSetClipRect(renderer, clipped ? &clip : NULL);
+		SDL_RenderSetScale(renderer, scale_x, scale_y);
+	}
+	SDL_SetRenderDrawColor(renderer, draw.r, draw.g, draw.b, draw.a);
+	return SDL_TRUE;
 }
 
-/******************************************************************************
- * Font definition and open/close
- *****************************************************************************/
+/* Lays out the text of a block at (0, 0) and draws it into the texture
+ * of the block. Returns SDL_FALSE if the block cannot be cached. */
+static SDL_bool FOX_DrawBlock(FOX_Block *block, const Uint8 *text,
+												const SDL_Rect *rect
+) {
+	FOX_Font *font = block->font;
+	int resets = SDL_AtomicGet(&FOX_target_resets);
+	SDL_Rect area = {0, 0, rect->w, rect->h};
+	const Uint8 *endptr = NULL;
+	FOX_SetBatchColor(font, block->color);
+	block->state = FOX_BatchTextInside(font, text, &endptr, &area, -1);
+	block->end = endptr ? (size_t)(endptr - text) : 0;
 
-struct FOX_Font {
-	SDL_Renderer *renderer;
-	SDL_Texture *atlas;
-	FOX_GlyphMetrics *metrics;
-	FT_Face face;	/* freetype font face */
-	int length;		/* side length of the atlas texture (sqrt(width^2)) */
-	FOX_FontMetrics size;
-	SDL_bool use_kerning;
-};
+	SDL_Rect bounds;
+	FOX_BatchBounds(font, &bounds);
+	size_t bytes = sizeof(*block) + block->length + 1
+					+ (size_t)bounds.w * (size_t)bounds.h * 4;
+	if(bytes > FOX_block_cache_size) goto abort;
 
-#ifdef FOX_USE_FONTCONFIG
-FOX_Font* FOX_OpenFontFc(SDL_Renderer *renderer, const unsigned char *fontstr) {
-	FcPattern *pattern = FcNameParse(fontstr);
-	if(!pattern) return NULL;
+	if(!block->string) {
+		block->string = SDL_malloc(block->length + 1);
+		if(!block->string) goto abort;
+		SDL_memcpy(block->string, text, block->length + 1);
+	}
+	if(block->texture && (block->bounds.w != bounds.w
+						|| block->bounds.h != bounds.h)
+	) {
+		SDL_DestroyTexture(block->texture);
+		block->texture = NULL;
+	}
+	block->bounds = bounds;
 
-	FcConfigSubstitute(NULL, pattern, FcMatchPattern);
-	FcDefaultSubstitute(pattern);
-	FcResult result;
-	FcPattern *match = FcFontMatch(NULL, pattern, &result);
-	if(!match) {
-		FcPatternDestroy(pattern);
-		return NULL;
+	/* Make room before creating the texture */
+	FOX_ResizeBlock(block, bytes);
+	FOX_TrimBlocks(0, block);
+	if(bounds.w > 0 && bounds.h > 0) {
+		if(!block->texture) {
+			block->texture = SDL_CreateTexture(font->shared->renderer,
+				SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+				bounds.w, bounds.h);
+			if(!block->texture) goto abort;
+			SDL_SetTextureBlendMode(block->texture, SDL_BLENDMODE_BLEND);
+		}
+		if(!FOX_FlushBatchInto(font, block->texture, block->color)) {
+			goto abort;
+		}
 	}
 
-	int size;
-	FcChar8 *path;
-	FcPatternGetString(match, FC_FILE, 0, &path);
-	FcPatternGetInteger(match, FC_SIZE, 0, &size);
+	if(!FOX_watching_resets) {
+		SDL_AddEventWatch(FOX_WatchResets, NULL);
+		FOX_watching_resets = SDL_TRUE;
+	}
+	block->generation = font->generation;
+	block->resets = resets;
+	return SDL_TRUE;
 
-	FOX_Font *font = FOX_OpenFont(renderer, (const char*)path, size);
-	FcPatternDestroy(match);
-	FcPatternDestroy(pattern);
-	return font;
+	abort:
+		FOX_DiscardBatch(font);
+		return SDL_FALSE;
 }
-#endif /* FOX_USE_FONTCONFIG */
 
-static SDL_Surface* FOX_RenderFontToSurface(FOX_Font *font);
+int FOX_RenderTextBlock(FOX_Font *font, const Uint8 *text,
+				const Uint8 **endptr, const SDL_Rect *rect
+) {
+	if(!FOX_FontReady(font)) return -1;
+	if(!font->shared->renderer || FOX_block_cache_size == 0) {
+		return FOX_RenderTextInside(font, text, endptr, rect, -1);
+	}
 
-FOX_Font* FOX_OpenFont(SDL_Renderer *renderer, const char *path, int size) {
-	FOX_Font *font = SDL_calloc(1, sizeof(*font));
-	font->renderer = renderer;
+	SDL_Color color;
+	SDL_GetRenderDrawColor(font->shared->renderer, &color.r, &color.g, &color.b,
+															&color.a);
+	color.a = 255;
+	size_t length = SDL_strlen((const char*)text);
+	Uint64 hash = FOX_HashBytes(FOX_FNV_OFFSET, text, length);
+	FOX_Block *block = FOX_FindBlock(font, text, length, hash, rect, color);
+	if(!block) {
+		FOX_AddBlock(font, length, hash, rect, color);
+		return FOX_RenderTextInside(font, text, endptr, rect, -1);
+	}
 
-	/* Open the font file using libfreetype */
-	if(FT_New_Face(libfreetype, path, 0, &font->face)) {
-		goto abort0;
+	FOX_UnlinkBlock(block);
+	FOX_PushBlock(block);
+	if(block->direct) {
+		return FOX_RenderTextInside(font, text, endptr, rect, -1);
+	}
+	if(!block->string || block->generation != font->generation
+		|| block->resets != SDL_AtomicGet(&FOX_target_resets)
+	) {
+		if(!FOX_DrawBlock(block, text, rect)) {
+			FOX_UncacheBlock(block);
+			return FOX_RenderTextInside(font, text, endptr, rect, -1);
+		}
 	}
 
-	/* Set the pixel size for rendering characters */
-	if(FT_Set_Pixel_Sizes(font->face, size, size)) {
-		goto abort1;
+	if(block->texture) {
+		SDL_Rect dstrect = {
+			rect->x + block->bounds.x, rect->y + block->bounds.y,
+			block->bounds.w, block->bounds.h
+		};
+		SDL_RenderCopy(font->shared->renderer, block->texture, NULL, &dstrect);
+		FOX_COUNT(font->shared, draw_calls, 1);
 	}
 
-	/* Calculate atlas surface dimensions */
-	int length = (int)SDL_ceil(SDL_sqrt(font->face->num_glyphs));
+	if(block->state == 0) {
+		*endptr = NULL;
+	} else if(block->state > 0) {
+		*endptr = text + block->end;
+	}
+	return block->state;
+}
 
-	/* Set font parameters */
-	font->length = length;
-	font->size.ptsize = size;
-	font->size.height = font->face->size->metrics.height >> 6;
-	font->use_kerning = FT_HAS_KERNING(font->face);
+void FOX_SetBlockCacheSize(size_t bytes) {
+	FOX_block_cache_size = bytes;
+	FOX_TrimBlocks(0, NULL);
+}
 
-	/* Render characters to surface */
-	SDL_Surface *surface = FOX_RenderFontToSurface(font);
-	if(!surface) goto abort1;
-	
-	/* Convert SDL surface into SDL texture and enable alpha blending */
-	font->atlas = SDL_CreateTextureFromSurface(font->renderer, surface);
-	SDL_SetTextureBlendMode(font->atlas, SDL_BLENDMODE_BLEND);
-	SDL_FreeSurface(surface);
+void FOX_ClearBlockCache(void) {
+	while(FOX_blocks) FOX_FreeBlock(FOX_blocks);
+	if(FOX_watching_resets) {
+		SDL_DelEventWatch(FOX_WatchResets, NULL);
+		FOX_watching_resets = SDL_FALSE;
+	}
+}
 
-	return font;
+/******************************************************************************
+ * Cell grids
+ *****************************************************************************/
 
-	/* Premature error handling */
-	abort1:
-		FT_Done_Face(font->face);
-	abort0:
-		SDL_free(font);
-		return NULL;
-}
+/* A row of a grid with its quads placed relative to the top left corner
+ * of the row, so that scrolling only moves rows around. */
+typedef struct {
+	FOX_Cell *cells;
+	FOX_Batch background;	/* untextured background and underline quads */
+	FOX_Batch *runs;		/* glyph quads for each atlas page */
+	SDL_Texture **textures;	/* atlas page of each run */
+	int num_runs;
+	SDL_bool dirty;			/* quads have to be laid out again */
+} FOX_GridRow;
 
-void FOX_CloseFont(FOX_Font *font) {
-	SDL_DestroyTexture(font->atlas);
-	FT_Done_Face(font->face);
-	SDL_free(font->metrics);
-	SDL_free(font);
+struct FOX_Grid {
+	FOX_Font *font;
+	int columns;
+	int num_rows;
+	FOX_GridRow *rows;		/* from top to bottom */
+	SDL_Point cell;			/* size of a cell when the rows were laid out */
+	Uint64 generation;		/* of the layout, see FOX_LayoutGeneration() */
+	FOX_Batch background;	/* quads of all rows, ready for submission */
+	FOX_Batch *pages;		/* glyph quads of all rows for each atlas page */
+	SDL_Texture **textures;	/* atlas page of each batch of pages */
+	int num_pages;
+	SDL_Point origin;		/* position the quads of all rows are placed at */
+	SDL_bool changed;		/* quads of all rows have to be gathered again */
+};
+
+static void FOX_FreeBatch(FOX_Batch *batch) {
+	SDL_free(batch->vertices);
+	SDL_free(batch->indices);
 }
 
-/*****************************************************************************/
+/* Grows the batch buffers, so that at least count quads fit. */
+static SDL_bool FOX_ReserveBatch(FOX_Batch *batch, int count) {
+	while(batch->capacity < count) {
+		if(!FOX_GrowBatch(batch)) return SDL_FALSE;
+	}
+	return SDL_TRUE;
+}
 
-static void FOX_SetMetrics(FOX_Font *font, Uint32 index, int xpos, int ypos) {
-	font->metrics[index].rect.x = xpos * font->size.ptsize;
-	font->metrics[index].rect.y = ypos * font->size.ptsize;
-	font->metrics[index].rect.w = font->face->glyph->metrics.width >> 6;
-	font->metrics[index].rect.h = font->face->glyph->metrics.height >> 6;
-	font->metrics[index].bearing.x = font->face->glyph->metrics.horiBearingX >> 6;
-	font->metrics[index].bearing.y = font->face->glyph->metrics.horiBearingY >> 6;
-	font->metrics[index].advance = font->face->glyph->metrics.horiAdvance >> 6;
-	if(font->size.max_width < font->metrics[index].rect.w) {
-		font->size.max_width = font->metrics[index].rect.w;
+/* Appends an untextured quad, extending the last quad instead if it has
+ * the same color and ends where the new one starts. */
+static SDL_bool FOX_AddColorQuad(FOX_Batch *batch, const SDL_Rect *rect,
+											SDL_Color color
+) {
+	float x0 = (float)rect->x;
+	float y0 = (float)rect->y;
+	float x1 = (float)(rect->x + rect->w);
+	float y1 = (float)(rect->y + rect->h);
+	if(batch->count > 0) {
+		SDL_Vertex *last = &batch->vertices[(batch->count - 1) * 4];
+		if(last[1].position.x == x0 && last[0].position.y == y0
+			&& last[2].position.y == y1
+			&& SDL_memcmp(&last[0].color, &color, sizeof(color)) == 0
+		) {
+			last[1].position.x = x1;
+			last[3].position.x = x1;
+			return SDL_TRUE;
+		}
 	}
-	if(font->size.max_height < font->metrics[index].rect.h) {
-		font->size.max_height = font->metrics[index].rect.h;
+
+	if(!FOX_ReserveBatch(batch, batch->count + 1)) return SDL_FALSE;
+	SDL_Vertex *vertex = &batch->vertices[batch->count * 4];
+	vertex[0] = (SDL_Vertex){{x0, y0}, color, {0.0f, 0.0f}};
+	vertex[1] = (SDL_Vertex){{x1, y0}, color, {0.0f, 0.0f}};
+	vertex[2] = (SDL_Vertex){{x0, y1}, color, {0.0f, 0.0f}};
+	vertex[3] = (SDL_Vertex){{x1, y1}, color, {0.0f, 0.0f}};
+	batch->count++;
+	return SDL_TRUE;
+}
+
+/* Appends the quads of a batch, moved by (dx, dy). */
+static SDL_bool FOX_AppendQuads(FOX_Batch *batch, const FOX_Batch *quads,
+												float dx, float dy
+) {
+	if(!FOX_ReserveBatch(batch, batch->count + quads->count)) {
+		return SDL_FALSE;
 	}
-	if(font->size.max_advance < font->metrics[index].advance) {
-		font->size.max_advance = font->metrics[index].advance;
+
+	SDL_Vertex *vertex = &batch->vertices[batch->count * 4];
+	for(int v = 0; v < quads->count * 4; v++) {
+		vertex[v] = quads->vertices[v];
+		vertex[v].position.x += dx;
+		vertex[v].position.y += dy;
 	}
+	batch->count += quads->count;
+	return SDL_TRUE;
 }
 
-SDL_Surface* FOX_RenderFontToSurface(FOX_Font *font) {
-	/* Allocate SDL surface */
-	int width = font->length * font->size.ptsize;
-	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, width, width,
-												32, SDL_PIXELFORMAT_RGBA32);
-	if(!surface) return NULL;
+static void FOX_ResetCell(FOX_Cell *cell) {
+	*cell = (FOX_Cell){' ', {255, 255, 255, 255}, {0, 0, 0, 0}, 0};
+}
 
-	/* Allocate glyph metrics array */
-	font->metrics = SDL_malloc(sizeof(*font->metrics) * font->face->num_glyphs);
-	if(!font->metrics) {
-		SDL_FreeSurface(surface);
-		return NULL;
+/* Fills a row with copies of a cell or blank cells if NULL. */
+static void FOX_FillGridRow(FOX_Grid *grid, FOX_GridRow *row,
+										const FOX_Cell *fill
+) {
+	for(int column = 0; column < grid->columns; column++) {
+		if(fill) row->cells[column] = *fill;
+		else FOX_ResetCell(&row->cells[column]);
 	}
+	row->dirty = SDL_TRUE;
+}
 
-	FT_UInt index;
-	int xpos = 0;
-	int ypos = 0;
+/* Lays out the quads of a row. Backgrounds of neighbouring cells of the
+ * same color are merged and glyphs are placed on the baseline of the
+ * cells, with underlines drawn after all backgrounds of the row. */
+static SDL_bool FOX_LayoutGridRow(FOX_Grid *grid, FOX_GridRow *row) {
+	FOX_Font *font = grid->font;
+	int ascent = (int)(font->shared->face->size->metrics.ascender >> 6);
+	int thickness = SDL_max(font->shared->size.height / 16, 1);
+	SDL_Rect rect = {0, 0, grid->cell.x, grid->cell.y};
+	SDL_Color color = {0, 0, 0, 0};
+	SDL_bool colored = SDL_FALSE;
 
-	for(FT_ULong charcode = FT_Get_First_Char(font->face, &index);
-		index != 0;
-		charcode = FT_Get_Next_Char(font->face, charcode, &index)
-	) {
-		if(xpos < (font->length - 1)) {
-			xpos++;
-		} else {
-			xpos = 0;
-			ypos++;
+	row->background.count = 0;
+	for(int column = 0; column < grid->columns; column++) {
+		const FOX_Cell *cell = &row->cells[column];
+		SDL_bool inverse = (cell->attributes & FOX_CELL_INVERSE) != 0;
+		SDL_Color fg = inverse ? cell->bg : cell->fg;
+		SDL_Color bg = inverse ? cell->fg : cell->bg;
+		rect.x = column * grid->cell.x;
+		if(bg.a > 0 && !FOX_AddColorQuad(&row->background, &rect, bg)) {
+			goto abort;
 		}
 
-		FT_Load_Char(font->face, charcode, FT_LOAD_RENDER);
-		FT_Bitmap *bitmap = &font->face->glyph->bitmap;
-		if(bitmap->pixel_mode != ft_pixel_mode_grays) {
-			break;
+		/* Skip spaces and control characters */
+		if(cell->ch <= ' ' || cell->ch == 0x7F) continue;
+		if(!colored || SDL_memcmp(&fg, &color, sizeof(color)) != 0) {
+			FOX_SetBatchColor(font, fg);
+			color = fg;
+			colored = SDL_TRUE;
 		}
+		/* FOX_BatchChar() puts the baseline size.height down */
+		SDL_Point position = {rect.x, ascent - font->shared->size.height};
+		FOX_BatchChar(font, cell->ch, 0, &position);
+	}
 
-		FOX_SetMetrics(font, index, xpos, ypos);
+	for(int column = 0; column < grid->columns; column++) {
+		const FOX_Cell *cell = &row->cells[column];
+		if(!(cell->attributes & FOX_CELL_UNDERLINE)) continue;
+		SDL_Color fg = cell->attributes & FOX_CELL_INVERSE
+										? cell->bg : cell->fg;
+		SDL_Rect line = {
+			column * grid->cell.x,
+			SDL_min(ascent + 1, grid->cell.y - thickness),
+			grid->cell.x, thickness
+		};
+		if(!FOX_AddColorQuad(&row->background, &line, fg)) goto abort;
+	}
 
-		int xreal = xpos * font->size.ptsize;
-		int yreal = ypos * font->size.ptsize;
-		for(int y = 0; y < bitmap->rows; y++) {
-			for(int x = 0; x < bitmap->width; x++) {
-				int index = (yreal + y) * surface->w + xreal + x;
-				Uint32 *pixel = &((Uint32*)surface->pixels)[index];
-				Uint8 alpha = bitmap->buffer[y * bitmap->pitch + x];
-				*pixel = SDL_MapRGBA(surface->format, 255, 255, 255, alpha);
-			}
-		}
+	if(!FOX_TakeBatches(font, &row->runs, &row->textures,
+											&row->num_runs)
+	) {
+		return SDL_FALSE;
 	}
+	row->dirty = SDL_FALSE;
+	return SDL_TRUE;
 
-	return surface;
+	abort:
+		FOX_DiscardBatch(font);
+		return SDL_FALSE;
 }
 
-/******************************************************************************
- * Font rendering
- *****************************************************************************/
+/* Returns the batch of all rows for an atlas page, adding it if needed. */
+static FOX_Batch* FOX_GridPage(FOX_Grid *grid, SDL_Texture *texture) {
+	for(int i = 0; i < grid->num_pages; i++) {
+		if(grid->textures[i] == texture) return &grid->pages[i];
+	}
 
-static const Uint8* skip_whitespace(const Uint8 *text) {
-	while(SDL_isspace(*text)) text++;
-	return text;
+	int n = grid->num_pages + 1;
+	FOX_Batch *pages = SDL_realloc(grid->pages, sizeof(*pages) * n);
+	if(!pages) return NULL;
+	grid->pages = pages;
+	SDL_Texture **textures = SDL_realloc(grid->textures,
+										sizeof(*textures) * n);
+	if(!textures) return NULL;
+	grid->textures = textures;
+
+	SDL_memset(&pages[n - 1], 0, sizeof(*pages));
+	textures[n - 1] = texture;
+	grid->num_pages = n;
+	return &pages[n - 1];
 }
 
-static SDL_bool FOX_NextWordFitsOnLine(FOX_Font *font, const Uint8 *text,
-									const SDL_Point *position, int maxX
-) {
-	SDL_Point cursor = *position;
-	Uint32 previous_ch = 0;
-	for(text = skip_whitespace(text); *text; text++) {
-		Uint32 ch = FOX_Utf8Decode(text, &text);
-		if(ch == '\n' || ch == '\t' || ch == ' ' || ch == '\r') {
-			break;
-		} else {
-			cursor.x += FOX_GetAdvance(font, ch, previous_ch);
-			previous_ch = ch;
+/* Lays out the dirty rows of a grid. Pages used by rows laid out are
+ * pinned, so that later rows cannot evict their glyphs. Rows left alone
+ * may lose theirs though, in which case all rows are laid out again. */
+static SDL_bool FOX_LayoutGridRows(FOX_Grid *grid, SDL_bool all) {
+	FOX_Font *font = grid->font;
+	for(;;) {
+		Uint64 generation = FOX_LayoutGeneration(font);
+		SDL_bool laid_out = SDL_TRUE;
+		FOX_PinPages(font, SDL_TRUE);
+		for(int y = 0; y < grid->num_rows && laid_out; y++) {
+			FOX_GridRow *row = &grid->rows[y];
+			row->dirty |= all;
+			if(!row->dirty) continue;
+			laid_out = FOX_LayoutGridRow(grid, row);
+			grid->changed = SDL_TRUE;
 		}
+		FOX_PinPages(font, SDL_FALSE);
+		if(!laid_out) return SDL_FALSE;
 
-		if(cursor.x >= maxX) return SDL_FALSE;
+		if(all || FOX_LayoutGeneration(font) == generation) break;
+		all = SDL_TRUE;
 	}
 
+	grid->generation = FOX_LayoutGeneration(font);
 	return SDL_TRUE;
 }
 
-static int FOX_RenderLine(FOX_Font *font, const Uint8 *text,
-	const Uint8 **endptr, const SDL_Point *position, int width, int n
-) {
-	int maxX = position->x + width;
-	SDL_Point cursor = *position;
-	Uint32 previous_ch = 0;
-	SDL_bool unsafe = SDL_TRUE;
+/* Drops the batches of pages no row draws from anymore, as their pages
+ * may have been freed along with their textures. */
+static void FOX_DropGridPages(FOX_Grid *grid) {
+	int n = 0;
+	for(int i = 0; i < grid->num_pages; i++) {
+		if(grid->pages[i].count == 0) {
+			FOX_FreeBatch(&grid->pages[i]);
+			continue;
+		}
+		grid->pages[n] = grid->pages[i];
+		grid->textures[n] = grid->textures[i];
+		n++;
+	}
+	grid->num_pages = n;
+}
 
-	/* Skip any whitespace at the beginning of a new line */
-	for(text = skip_whitespace(text); *text; text++) {
-		if(n == 0) break;
+/* Lays out dirty rows and gathers the quads of all rows at the given
+ * position for submission, if anything changed. The gathered batches
+ * only hold the quads of the rows, so that what is submitted is bounded
+ * by the cells drawn rather than by the size of the grid. */
+static SDL_bool FOX_UpdateGrid(FOX_Grid *grid, const SDL_Point *position) {
+	FOX_Font *font = grid->font;
+	if(!FOX_FontReady(font)) return SDL_FALSE;
 
-		/* We shall not exceed the line width by printing the next char. */
-		if(unsafe && ((cursor.x + font->size.ptsize) >= maxX)) {
-			*endptr = text;
-			break;
-		}
+	/* The advance of dynamic fonts grows as glyphs are loaded */
+	const FOX_FontMetrics *size = &font->shared->size;
+	SDL_Point cell = {size->max_advance, size->height};
+	SDL_bool all = grid->generation != FOX_LayoutGeneration(font)
+					|| cell.x != grid->cell.x || cell.y != grid->cell.y;
+	grid->cell = cell;
+	if(!FOX_LayoutGridRows(grid, all)) return SDL_FALSE;
 
-		Uint32 ch = FOX_Utf8Decode(text, &text);
-		if(ch == '\n') {
-			continue;
-		} else {
-			cursor.x += FOX_RenderChar(font, ch, previous_ch, &cursor);
-			previous_ch = ch;
-			if(ch == ' ') {
-				if(!FOX_NextWordFitsOnLine(font, text, &cursor, maxX)) {
-					unsafe = SDL_TRUE;
-					break;
-				} else unsafe = SDL_FALSE;
+	if(!grid->changed && grid->origin.x == position->x
+		&& grid->origin.y == position->y
+	) {
+		return SDL_TRUE;
+	}
+
+	grid->background.count = 0;
+	for(int i = 0; i < grid->num_pages; i++) {
+		grid->pages[i].count = 0;
+	}
+	for(int y = 0; y < grid->num_rows; y++) {
+		FOX_GridRow *row = &grid->rows[y];
+		float dx = (float)position->x;
+		float dy = (float)(position->y + y * grid->cell.y);
+		if(!FOX_AppendQuads(&grid->background, &row->background, dx, dy)) {
+			return SDL_FALSE;
+		}
+		for(int r = 0; r < row->num_runs; r++) {
+			if(row->runs[r].count == 0) continue;
+			FOX_Batch *page = FOX_GridPage(grid, row->textures[r]);
+			if(!page || !FOX_AppendQuads(page, &row->runs[r], dx, dy)) {
+				return SDL_FALSE;
 			}
 		}
-
-		if(n > 0) n--;
 	}
+	FOX_DropGridPages(grid);
 
-	*endptr = text;
-	return n;
+	grid->origin = *position;
+	grid->changed = SDL_FALSE;
+	return SDL_TRUE;
 }
 
-/*****************************************************************************/
+FOX_Grid* FOX_CreateGrid(FOX_Font *font, int columns, int rows) {
+	if(columns <= 0 || rows <= 0) {
+		SDL_SetError("Invalid grid size %dx%d", columns, rows);
+		return NULL;
+	}
 
-int FOX_RenderChar(FOX_Font *font, Uint32 ch, Uint32 previous_ch,
-										const SDL_Point *position
-) {
-	int advance = 0;
-	const FOX_GlyphMetrics *metrics = FOX_QueryGlyphMetrics(font, ch);
-	if(metrics) {
-		SDL_Rect dstrect;
-		SDL_Color color;
+	FOX_Grid *grid = SDL_calloc(1, sizeof(*grid));
+	if(!grid) return NULL;
+	grid->font = font;
+	grid->columns = columns;
+	grid->num_rows = rows;
+	grid->changed = SDL_TRUE;
+	grid->rows = SDL_calloc(rows, sizeof(*grid->rows));
+	if(!grid->rows) goto abort;
 
-		dstrect.x = position->x;
-		dstrect.y = position->y - metrics->bearing.y + font->size.height;
-		dstrect.w = metrics->rect.w;
-		dstrect.h = metrics->rect.h;
+	for(int y = 0; y < rows; y++) {
+		FOX_GridRow *row = &grid->rows[y];
+		row->cells = SDL_malloc(sizeof(*row->cells) * columns);
+		if(!row->cells) goto abort;
+		FOX_FillGridRow(grid, row, NULL);
+	}
+	return grid;
 
-		if(previous_ch) {
-			advance += FOX_GetKerningOffset(font, ch, previous_ch);
-			dstrect.x += advance;
+	abort:
+		FOX_DestroyGrid(grid);
+		return NULL;
+}
+
+void FOX_DestroyGrid(FOX_Grid *grid) {
+	if(!grid) return;
+	for(int y = 0; grid->rows && y < grid->num_rows; y++) {
+		FOX_GridRow *row = &grid->rows[y];
+		for(int r = 0; r < row->num_runs; r++) {
+			FOX_FreeBatch(&row->runs[r]);
 		}
+		SDL_free(row->runs);
+		SDL_free(row->textures);
+		FOX_FreeBatch(&row->background);
+		SDL_free(row->cells);
+	}
+	for(int i = 0; i < grid->num_pages; i++) {
+		FOX_FreeBatch(&grid->pages[i]);
+	}
+	SDL_free(grid->pages);
+	SDL_free(grid->textures);
+	FOX_FreeBatch(&grid->background);
+	SDL_free(grid->rows);
+	SDL_free(grid);
+}
 
-		SDL_GetRenderDrawColor(font->renderer, &color.r,
-							&color.g, &color.b, &color.a);
-		SDL_SetTextureColorMod(font->atlas, color.r, color.g, color.b);
-		SDL_RenderCopyEx(font->renderer, font->atlas, &metrics->rect,
-								&dstrect, 0.0, NULL, SDL_FLIP_NONE);
-		advance += metrics->advance;
+void FOX_SetGridCell(FOX_Grid *grid, int column, int row,
+								const FOX_Cell *cell
+) {
+	if(column < 0 || column >= grid->columns
+		|| row < 0 || row >= grid->num_rows
+	) {
+		return;
 	}
 
-	return advance;
+	/* Rewriting a cell as it is leaves its row alone */
+	FOX_Cell *old = &grid->rows[row].cells[column];
+	if(SDL_memcmp(old, cell, sizeof(*cell)) != 0) {
+		*old = *cell;
+		grid->rows[row].dirty = SDL_TRUE;
+	}
 }
 
-void FOX_RenderText(FOX_Font *font, const Uint8 *text,
-							const SDL_Point *position
-) {
-	SDL_Point cursor = *position;
-	Uint32 previous_ch = 0;
-	for(; *text; text++) {
-		Uint32 ch = FOX_Utf8Decode(text, &text);
-		if(ch == '\n') {
-			cursor.x = position->x;
-			cursor.y += font->size.height;
-			previous_ch = 0;
-			continue;
-		} else {
-			cursor.x += FOX_RenderChar(font, ch, previous_ch, &cursor);
-			previous_ch = ch;
-		}
+const FOX_Cell* FOX_GetGridCell(FOX_Grid *grid, int column, int row) {
+	if(column < 0 || column >= grid->columns
+		|| row < 0 || row >= grid->num_rows
+	) {
+		return NULL;
 	}
+	return &grid->rows[row].cells[column];
 }
 
-int FOX_RenderTextInside(FOX_Font *font, const Uint8 *text,
-			const Uint8 **endptr, const SDL_Rect *rect, int n
+int FOX_SetGridText(FOX_Grid *grid, int column, int row,
+				const Uint8 *text, SDL_Color fg, SDL_Color bg,
+				Uint32 attributes
 ) {
-	int state = 0;
-	unsigned linesAvailable = rect->h / font->size.height;
-	if(linesAvailable == 0) {
-		return -1;
+	int count = 0;
+	for(; *text && column + count < grid->columns; text++, count++) {
+		FOX_Cell cell = {FOX_Utf8Decode(text, &text), fg, bg, attributes};
+		FOX_SetGridCell(grid, column + count, row, &cell);
 	}
+	return count;
+}
 
-	#ifdef FOX_DEBUG
-	{
-		SDL_Color rc;
-		SDL_GetRenderDrawColor(font->renderer, &rc.r, &rc.g, &rc.b, &rc.a);
-		SDL_SetRenderDrawColor(font->renderer, 255, 255, 255, 255);
-		SDL_RenderDrawRect(font->renderer, rect);
-		SDL_SetRenderDrawColor(font->renderer, rc.r, rc.g, rc.b, rc.a);
+/* Reverses the order of the rows in [first, last). */
+static void FOX_ReverseGridRows(FOX_Grid *grid, int first, int last) {
+	for(last--; first < last; first++, last--) {
+		FOX_GridRow row = grid->rows[first];
+		grid->rows[first] = grid->rows[last];
+		grid->rows[last] = row;
 	}
-	#endif
+}
 
-	SDL_Point cursor = {rect->x, rect->y};
-	for(unsigned line = 0; line < linesAvailable; line++) {
-		n = FOX_RenderLine(font, text, &text, &cursor, rect->w, n);
-		if(n == 0) {
-			state = 1;
-			break;
-		}
+void FOX_ScrollGrid(FOX_Grid *grid, int lines, const FOX_Cell *fill) {
+	int n = grid->num_rows;
+	int shift = SDL_min(SDL_abs(lines), n);
+	if(shift == 0) return;
 
-		cursor.x = rect->x;
-		cursor.y += font->size.height;
-	}
+	/* Rotate the rows, reusing the ones scrolled out for the new ones.
+	 * Rows moved keep their quads. */
+	int split = lines > 0 ? shift : n - shift;
+	FOX_ReverseGridRows(grid, 0, split);
+	FOX_ReverseGridRows(grid, split, n);
+	FOX_ReverseGridRows(grid, 0, n);
 
-	if(*text != '\0') {
-		*endptr = text;
-		return state + 1;
-	} else {
-		*endptr = NULL;
-		return 0;
+	int first = lines > 0 ? n - shift : 0;
+	for(int y = first; y < first + shift; y++) {
+		FOX_FillGridRow(grid, &grid->rows[y], fill);
 	}
+	grid->changed = SDL_TRUE;
 }
 
-void FOX_RenderAtlas(FOX_Font *font, SDL_Point *pos) {
-	SDL_Rect dstrect = {pos->x, pos->y, font->length * font->size.ptsize,
-										font->length * font->size.ptsize};
-	SDL_RenderCopy(font->renderer, font->atlas, NULL, &dstrect);
+void FOX_QueryGridSize(FOX_Grid *grid, int *w, int *h) {
+	FOX_Font *font = grid->font;
+	SDL_bool ready = FOX_FontReady(font);
+	if(w) *w = ready ? grid->columns * font->shared->size.max_advance : 0;
+	if(h) *h = ready ? grid->num_rows * font->shared->size.height : 0;
+}
+
+void FOX_RenderGrid(FOX_Grid *grid, const SDL_Point *position) {
+	if(!FOX_UpdateGrid(grid, position)) return;
+
+	FOX_Font *font = grid->font;
+	FOX_Batch *background = &grid->background;
+	if(background->count > 0) {
+		SDL_RenderGeometry(font->shared->renderer, NULL, background->vertices,
+			background->count * 4, background->indices,
+			background->count * 6);
+		FOX_COUNT(font->shared, draw_calls, 1);
+	}
+
+	for(int i = 0; i < grid->num_pages; i++) {
+		FOX_Batch *page = &grid->pages[i];
+		if(page->count == 0) continue;
+		SDL_RenderGeometry(font->shared->renderer, grid->textures[i],
+			page->vertices, page->count * 4, page->indices, page->count * 6);
+		FOX_COUNT(font->shared, draw_calls, 1);
+		FOX_COUNT(font->shared, glyphs_rendered, page->count);
+	}
+	FOX_TouchPages(font, grid->textures, grid->pages, grid->num_pages);
 }
 
 /******************************************************************************
@@ -440,27 +5364,32 @@ void FOX_RenderAtlas(FOX_Font *font, SDL_Point *pos) {
  *****************************************************************************/
 
 const FOX_GlyphMetrics* FOX_QueryGlyphMetrics(FOX_Font *font, Uint32 ch) {
-	const FOX_GlyphMetrics *metrics = NULL;
-	FT_UInt glyph_index = FT_Get_Char_Index(font->face, ch);
-	if(glyph_index != 0) {
-		metrics = &font->metrics[glyph_index];
-	}
-
-	return metrics;
+	if(!FOX_FontReady(font)) return NULL;
+	FOX_SharedFont *owner;
+	const FOX_Glyph *glyph = FOX_ResolveGlyph(font, ch, &owner);
+	return glyph ? &glyph->metrics : NULL;
 }
 
 int FOX_GetKerningOffset(FOX_Font *font, Uint32 ch, Uint32 previous_ch) {
 	int offset = 0;
 
-	if(font->use_kerning) {
-		FT_UInt glyph_index = FT_Get_Char_Index(font->face, ch);
-		FT_UInt previous_glyph_index = FT_Get_Char_Index(font->face,
-														previous_ch);
+	if(FOX_FontReady(font) && font->use_kerning
+		&& FT_HAS_KERNING(font->shared->face)
+	) {
+		FOX_SharedFont *shared = font->shared;
+		FOX_COUNT(shared, kerning_lookups, 1);
+		if(ch - FOX_KERNING_FIRST < FOX_KERNING_RANGE
+			&& previous_ch - FOX_KERNING_FIRST < FOX_KERNING_RANGE
+		) {
+			const Sint16 *row = FOX_GetKerningRow(shared, previous_ch);
+			if(row) return row[ch - FOX_KERNING_FIRST];
+		}
+
+		FT_UInt glyph_index = FOX_GetGlyphIndex(shared, ch);
+		FT_UInt previous_glyph_index = FOX_GetGlyphIndex(shared, previous_ch);
 		if(glyph_index && previous_glyph_index) {
-			FT_Vector delta;
-			FT_Get_Kerning(font->face, previous_glyph_index, glyph_index,
-											FT_KERNING_DEFAULT, &delta);
-			offset = delta.x >> 6;
+			offset = FOX_GetHashedKerning(shared, previous_glyph_index,
+														glyph_index);
 		}
 	}
 
@@ -478,9 +5407,95 @@ int FOX_GetAdvance(FOX_Font *font, Uint32 ch, Uint32 previous_ch) {
 }
 
 void FOX_EnableKerning(FOX_Font *font, SDL_bool enable) {
-	font->use_kerning = enable && FT_HAS_KERNING(font->face);
+	/* The setting belongs to the handle; faces without kerning ignore it */
+	if(font->use_kerning != enable) {
+		font->use_kerning = enable;
+		font->generation++;
+	}
 }
 
 const FOX_FontMetrics* FOX_QueryFontMetrics(FOX_Font *font) {
-	return &font->size;
+	return FOX_FontReady(font) ? &font->shared->size : NULL;
+}
+
+/******************************************************************************
+ * Text measurement
+ *****************************************************************************/
+
+void FOX_MeasureText(FOX_Font *font, const Uint8 *text, FOX_TextSize *size) {
+	if(!FOX_FontReady(font)) {
+		SDL_zerop(size);
+		return;
+	}
+
+	int x = 0, width = 0, lines = 0;
+	Uint32 previous_ch = 0;
+	SDL_bool line_start = SDL_TRUE;
+	FOX_Utf8Reader reader;
+	FOX_StartReader(&reader, text, text + SDL_strlen((const char*)text));
+	Uint32 ch;
+	while(FOX_ReadChar(&reader, &ch)) {
+		if(line_start) {
+			lines++;
+			line_start = SDL_FALSE;
+		}
+
+		if(ch == '\n') {
+			x = 0;
+			previous_ch = 0;
+			line_start = SDL_TRUE;
+		} else if(ch == '\r') {
+			continue;
+		} else if(ch == '\t') {
+			x += FOX_TabAdvance(font, x);
+			previous_ch = 0;
+		} else {
+			x += FOX_GetAdvance(font, ch, previous_ch);
+			previous_ch = ch;
+		}
+		width = SDL_max(width, x);
+	}
+
+	size->w = width;
+	size->h = lines * font->shared->size.height;
+	size->lines = lines;
+}
+
+void FOX_MeasureTexts(FOX_Font *font, const Uint8 *const *texts, int count,
+														FOX_TextSize *sizes
+) {
+	for(int i = 0; i < count; i++) {
+		FOX_MeasureText(font, texts[i], &sizes[i]);
+	}
+}
+
+size_t FOX_FitText(FOX_Font *font, const Uint8 *text, int width,
+														int *extent
+) {
+	const Uint8 *end = text;
+	int x = 0;
+	Uint32 previous_ch = 0;
+	if(!FOX_FontReady(font)) {
+		if(extent) *extent = 0;
+		return 0;
+	}
+	while(*end && *end != '\n') {
+		Uint32 ch;
+		int bytes = FOX_Utf8Next(end, (size_t)-1, &ch);
+		int advance = 0;
+		if(ch == '\t') {
+			advance = FOX_TabAdvance(font, x);
+			previous_ch = 0;
+		} else if(ch != '\r') {
+			advance = FOX_GetAdvance(font, ch, previous_ch);
+			previous_ch = ch;
+		}
+
+		if(x + advance > width) break;
+		x += advance;
+		end += bytes;
+	}
+
+	if(extent) *extent = x;
+	return end - text;
 }
@@ -39,6 +39,8 @@ extern DECLSPEC enum FOX_LibraryState SDLCALL FOX_Init(void);
 
 /* Deinitializes the SDL_fox library
  * Nothing is done if SDL_fox was not previously initialized.
+ * Fonts still open are freed along with their textures, so the handles
+ * of all fonts are invalid afterwards, and closing them is an error.
  */
 extern DECLSPEC void SDLCALL FOX_Exit(void);
 
@@ -52,10 +54,70 @@ extern DECLSPEC enum FOX_LibraryState SDLCALL FOX_WasInit(void);
 /* Internal font representation */
 typedef struct FOX_Font FOX_Font;
 
-/* Opens a font via a file-path and specified font parameters. */
+/* Flags controlling how a font is opened */
+enum FOX_OpenFlags {
+	FOX_OPEN_DEFAULT = 0x0,	/* rasterize every glyph when opening the font */
+	FOX_OPEN_DYNAMIC = 0x1,	/* rasterize glyphs on first use */
+	FOX_OPEN_PARALLEL = 0x2,	/* rasterize using one thread per CPU */
+	FOX_OPEN_SURFACE = 0x4	/* keep the atlas in memory to render into
+							 * surfaces, without a renderer */
+};
+
+/* Opens a font via a file-path and specified font parameters.
+ * Every call returns a handle of its own, but the face and atlas of fonts
+ * already open with the same parameters are shared between the handles.
+ * Settings such as kerning and fallback fonts belong to the handle. */
 extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFont(SDL_Renderer *renderer,
 										const char *path, int size);
 
+/* Opens a font via a file-path using a combination of enum FOX_OpenFlags. */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontEx(SDL_Renderer *renderer,
+								const char *path, int size, Uint32 flags);
+
+/* Opens face index of a font file, e.g. of a font collection (.ttc). */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontIndex(SDL_Renderer *renderer,
+					const char *path, int index, int size, Uint32 flags);
+
+/* Opens face index of a font held in memory. The memory is used in place
+ * and has to stay valid until the font is closed. */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontMem(SDL_Renderer *renderer,
+					const void *data, size_t datasize, int index,
+					int size, Uint32 flags);
+
+/* Opens face index of a font read from a stream, starting at its current
+ * position. The stream is read from as long as the font is open and is
+ * closed along with the font (or on error) if freesrc is non-zero. */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontRW(SDL_Renderer *renderer,
+					SDL_RWops *src, int freesrc, int index, int size,
+					Uint32 flags);
+
+/* Loading state of a font opened with FOX_OpenFontAsync() */
+enum FOX_FontState {
+	FOX_FONT_FAILED = -1,
+	FOX_FONT_LOADING,
+	FOX_FONT_READY
+};
+
+/* Opens a font like FOX_OpenFontEx(), but returns right away and loads the
+ * font on a background thread. The font cannot be used until it is ready;
+ * until then, rendering it does nothing and queries return nothing. */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontAsync(SDL_Renderer *renderer,
+								const char *path, int size, Uint32 flags);
+
+/* Opens face index of a font file like FOX_OpenFontIndex(), but loads it
+ * on a background thread like FOX_OpenFontAsync(). */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontAsyncIndex(
+					SDL_Renderer *renderer, const char *path, int index,
+					int size, Uint32 flags);
+
+/* Returns the loading state of a font without blocking. Fonts whose
+ * background thread is done are finished on the spot by creating their
+ * textures, so this must be called on the thread using the renderer. */
+extern DECLSPEC enum FOX_FontState SDLCALL FOX_PollFont(FOX_Font *font);
+
+/* Like FOX_PollFont(), but waits for the font to finish loading. */
+extern DECLSPEC enum FOX_FontState SDLCALL FOX_WaitFont(FOX_Font *font);
+
 /* build option to enable fontconfig */
 #ifdef FOX_USE_FONTCONFIG
 
@@ -63,11 +125,63 @@ extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFont(SDL_Renderer *renderer,
 extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontFc(SDL_Renderer *renderer,
 											const unsigned char *fontstr);
 
+/* Opens a font using a fontconfig string and enum FOX_OpenFlags. */
+extern DECLSPEC FOX_Font* SDLCALL FOX_OpenFontFcEx(SDL_Renderer *renderer,
+							const unsigned char *fontstr, Uint32 flags);
+
+/* Sets a file in which the fonts matching fontconfig strings are kept
+ * across runs. Its matches are loaded right away and FOX_Exit() writes
+ * it back. NULL stops persisting matches. */
+extern DECLSPEC SDL_bool SDLCALL FOX_SetFcCacheFile(const char *path);
+
+/* Resolves fontconfig strings on a background thread, so that opening
+ * fonts with them later on skips the fontconfig matching. */
+extern DECLSPEC SDL_bool SDLCALL FOX_PrewarmFc(
+						const unsigned char *const *fontstrs, int count);
+
 #endif /* FOX_USE_FONTCONFIG */
 
-/* Closes a previously opened font via its handle. */
+/* Rasterizes the glyphs for the characters first to last (inclusive) of a
+ * font opened with FOX_OPEN_DYNAMIC ahead of time.
+ * Returns the number of those characters available in the font. */
+extern DECLSPEC int SDLCALL FOX_PreloadGlyphs(FOX_Font *font,
+											Uint32 first, Uint32 last);
+
+/* Limits the atlas of a font opened with FOX_OPEN_DYNAMIC to the given
+ * number of bytes (0 for no limit). Once the limit is reached, the glyphs
+ * of the atlas page used least recently are evicted to make room.
+ * A handle sharing its atlas with others moves to an atlas of its own. */
+extern DECLSPEC SDL_bool SDLCALL FOX_SetAtlasBudget(FOX_Font *font,
+															size_t bytes);
+
+/* Sets a directory in which the atlases of fonts opened without
+ * FOX_OPEN_DYNAMIC are cached across runs. NULL disables caching. */
+extern DECLSPEC SDL_bool SDLCALL FOX_SetAtlasCacheDir(const char *path);
+
+/* Closes a previously opened font via its handle. The face and atlas are
+ * freed once no handle or fallback chain uses them anymore. Handles must
+ * not be closed after FOX_Exit(), which frees all fonts itself. */
 extern DECLSPEC void SDLCALL FOX_CloseFont(FOX_Font *font);
 
+/* Appends a font to the fallback chain of a font. Characters missing from
+ * a font are taken from the first font of its chain that provides them.
+ * The chain keeps its fonts open until it is cleared; their own chains
+ * and settings are not taken along. Fails for a handle of the same font. */
+extern DECLSPEC SDL_bool SDLCALL FOX_AddFallbackFont(FOX_Font *font,
+													FOX_Font *fallback);
+
+/* Removes all fonts from the fallback chain of a font. */
+extern DECLSPEC void SDLCALL FOX_ClearFallbackFonts(FOX_Font *font);
+
+#ifdef FOX_USE_FONTCONFIG
+
+/* Lets fontconfig find fonts for characters missing from a font and its
+ * fallback chain, appending them to the chain. */
+extern DECLSPEC void SDLCALL FOX_EnableFcFallback(FOX_Font *font,
+														SDL_bool enable);
+
+#endif /* FOX_USE_FONTCONFIG */
+
 /******************************************************************************
  * Font rendering
  *****************************************************************************/
@@ -80,6 +194,21 @@ extern DECLSPEC int SDLCALL FOX_RenderChar(FOX_Font *font, Uint32 ch,
 extern DECLSPEC void SDLCALL FOX_RenderText(FOX_Font *font,
 				const Uint8 *text, const SDL_Point *position);
 
+/* A run of text rendered in its own color and font */
+typedef struct {
+	size_t offset;		/* byte offset of the run inside the text */
+	size_t length;		/* bytes of the run */
+	SDL_Color color;
+	FOX_Font *font;		/* NULL to use the font of the text */
+} FOX_Style;
+
+/* Renders a utf-8 string of text at the given position, styling the runs
+ * of it given by an array of styles sorted by offset. Text outside of the
+ * runs is rendered like FOX_RenderText() renders it. */
+extern DECLSPEC void SDLCALL FOX_RenderStyledText(FOX_Font *font,
+				const Uint8 *text, const FOX_Style *styles,
+				int num_styles, const SDL_Point *position);
+
 enum FOX_PrintState {
 	FOX_ERROR = -1,
 	FOX_DONE_PRINTING,
@@ -91,10 +220,218 @@ enum FOX_PrintState {
 extern DECLSPEC int SDLCALL FOX_RenderTextInside(FOX_Font *font,
 	const Uint8 *text, const Uint8 **endptr, const SDL_Rect *rect, int n);
 
+/* A line of text laid out by FOX_LayoutText() */
+typedef struct {
+	size_t offset;	/* byte offset of the line inside the text */
+	size_t length;	/* bytes up to the end of the last visible character */
+	int width;		/* width of the line in pixels */
+} FOX_Line;
+
+/* Breaks a utf-8 string of text into lines that are at most width pixels
+ * wide. Returns the number of lines stored. */
+extern DECLSPEC int SDLCALL FOX_LayoutText(FOX_Font *font,
+					const Uint8 *text, int width, FOX_Line *lines,
+					int max_lines, const Uint8 **endptr);
+
 /* Primarily for debugging purposes, this function renders the entire font
  * atlas at the given position. */
 extern DECLSPEC void SDLCALL FOX_RenderAtlas(FOX_Font *font, SDL_Point *pos);
 
+/* Renders a utf-8 string of text into a surface at the given position,
+ * using a font opened with FOX_OPEN_SURFACE. Glyphs are alpha blended
+ * into the pixels of the surface, limited to its clip rect. */
+extern DECLSPEC void SDLCALL FOX_RenderTextToSurface(FOX_Font *font,
+						SDL_Surface *surface, const Uint8 *text,
+						const SDL_Point *position, SDL_Color color);
+
+/* Renders a utf-8 string of text into a surface inside the given rect,
+ * like FOX_RenderTextInside() does for a renderer. */
+extern DECLSPEC int SDLCALL FOX_RenderTextInsideSurface(FOX_Font *font,
+						SDL_Surface *surface, const Uint8 *text,
+						const Uint8 **endptr, const SDL_Rect *rect,
+						int n, SDL_Color color);
+
+/* Describes the size and occupancy of a font atlas. */
+typedef struct {
+	int pages;				/* number of atlas textures */
+	int glyphs;				/* number of glyphs stored in the atlas */
+	size_t used_pixels;		/* pixels covered by glyphs (including padding) */
+	size_t total_pixels;	/* pixels of all atlas textures */
+	size_t bytes;			/* memory used by the atlas pages */
+} FOX_AtlasInfo;
+
+/* Queries the size and occupancy of the font atlas. */
+extern DECLSPEC void SDLCALL FOX_QueryAtlasInfo(FOX_Font *font,
+												FOX_AtlasInfo *info);
+
+/* Runtime statistics of a font, collected if SDL_fox is built with
+ * FOX_USE_STATS. Counts and times accumulate until reset. */
+typedef struct {
+	Uint64 glyphs_rendered;		/* glyph quads submitted for drawing */
+	Uint64 draw_calls;			/* render calls issued with the atlas */
+	Uint64 glyph_hits;			/* lookups of glyphs present in the atlas */
+	Uint64 glyph_misses;		/* lookups of glyphs absent from the atlas */
+	Uint64 glyphs_rasterized;	/* glyphs rendered into the atlas */
+	Uint64 glyphs_evicted;		/* glyphs evicted from the atlas */
+	Uint64 kerning_lookups;		/* kerning offsets queried */
+	Uint64 kerning_misses;		/* kerning offsets requested from freetype */
+	Uint64 lines_laid_out;		/* lines broken off by text layout */
+	double open_ms;				/* time spent opening the font */
+	double rasterize_ms;		/* time spent rasterizing glyphs */
+	double layout_ms;			/* time spent breaking text into lines */
+	FOX_AtlasInfo atlas;		/* current size and occupancy of the atlas */
+} FOX_FontStats;
+
+/* Retrieves the statistics of a font. Returns SDL_FALSE if SDL_fox was
+ * built without FOX_USE_STATS, in which case only atlas is filled in. */
+extern DECLSPEC SDL_bool SDLCALL FOX_GetFontStats(FOX_Font *font,
+												FOX_FontStats *stats);
+
+/* Resets the counts and times of the statistics of a font to zero. */
+extern DECLSPEC void SDLCALL FOX_ResetFontStats(FOX_Font *font);
+
+/******************************************************************************
+ * Retained text
+ *****************************************************************************/
+
+/* Text laid out once and rendered any number of times */
+typedef struct FOX_Text FOX_Text;
+
+/* Creates a text object from a utf-8 string. Returns NULL on error. */
+extern DECLSPEC FOX_Text* SDLCALL FOX_CreateText(FOX_Font *font,
+											const Uint8 *string);
+
+/* Destroys a text object. */
+extern DECLSPEC void SDLCALL FOX_DestroyText(FOX_Text *text);
+
+/* Replaces the string of a text object. */
+extern DECLSPEC SDL_bool SDLCALL FOX_SetTextString(FOX_Text *text,
+											const Uint8 *string);
+
+/* Changes the font of a text object. */
+extern DECLSPEC void SDLCALL FOX_SetTextFont(FOX_Text *text, FOX_Font *font);
+
+/* Wraps the lines of a text object at the given width, 0 disables wrapping. */
+extern DECLSPEC void SDLCALL FOX_SetTextWrapWidth(FOX_Text *text, int width);
+
+/* Sets the color of a text object. */
+extern DECLSPEC void SDLCALL FOX_SetTextColor(FOX_Text *text,
+									Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+
+/* Queries the size of the laid out text. */
+extern DECLSPEC void SDLCALL FOX_QueryTextSize(FOX_Text *text,
+												int *w, int *h);
+
+/* Renders a text object at the given position. */
+extern DECLSPEC void SDLCALL FOX_RenderTextObject(FOX_Text *text,
+										const SDL_Point *position);
+
+/******************************************************************************
+ * Text reveal
+ *****************************************************************************/
+
+/* Text revealed character by character inside a rect, page by page */
+typedef struct FOX_Reveal FOX_Reveal;
+
+/* Creates a reveal object from a utf-8 string, showing none of its first
+ * page yet. Pages are laid out like FOX_RenderTextInside() lays them out.
+ * Returns NULL on error. */
+extern DECLSPEC FOX_Reveal* SDLCALL FOX_CreateReveal(FOX_Font *font,
+						const Uint8 *string, const SDL_Rect *rect);
+
+/* Destroys a reveal object. */
+extern DECLSPEC void SDLCALL FOX_DestroyReveal(FOX_Reveal *reveal);
+
+/* Reveals the next n characters of the page, all of them if n < 0.
+ * Returns the enum FOX_PrintState of the page. */
+extern DECLSPEC int SDLCALL FOX_RevealChars(FOX_Reveal *reveal, int n);
+
+/* Reveals as many characters as ms milliseconds at the given speed amount
+ * to. Returns the enum FOX_PrintState of the page. */
+extern DECLSPEC int SDLCALL FOX_RevealTime(FOX_Reveal *reveal, Uint32 ms,
+												float chars_per_second);
+
+/* Turns to the next page with none of it revealed, or back to the first
+ * page after the last one. Returns the enum FOX_PrintState of the page. */
+extern DECLSPEC int SDLCALL FOX_NextRevealPage(FOX_Reveal *reveal);
+
+/* Renders the revealed characters of the page using the render draw color.
+ * Returns the enum FOX_PrintState of the page. */
+extern DECLSPEC int SDLCALL FOX_RenderReveal(FOX_Reveal *reveal);
+
+/******************************************************************************
+ * Cached text blocks
+ *****************************************************************************/
+
+/* Renders a utf-8 string of text inside the given rect like
+ * FOX_RenderTextInside() with n < 0 does. Text rendered again with the
+ * same font, color and rect size is drawn from a cached texture. */
+extern DECLSPEC int SDLCALL FOX_RenderTextBlock(FOX_Font *font,
+	const Uint8 *text, const Uint8 **endptr, const SDL_Rect *rect);
+
+/* Sets how many bytes of memory cached text blocks may use, discarding
+ * the least recently used blocks beyond that. 0 disables caching. */
+extern DECLSPEC void SDLCALL FOX_SetBlockCacheSize(size_t bytes);
+
+/* Discards all cached text blocks. */
+extern DECLSPEC void SDLCALL FOX_ClearBlockCache(void);
+
+/******************************************************************************
+ * Cell grids
+ *****************************************************************************/
+
+/* Grid of equally sized cells, e.g. the screen of a terminal emulator */
+typedef struct FOX_Grid FOX_Grid;
+
+/* Attributes of a cell */
+enum FOX_CellAttributes {
+	FOX_CELL_UNDERLINE = 0x1,	/* underline in the foreground color */
+	FOX_CELL_INVERSE = 0x2		/* swap foreground and background color */
+};
+
+/* A character cell of a grid */
+typedef struct {
+	Uint32 ch;			/* codepoint, spaces and control characters are blank */
+	SDL_Color fg;		/* color of the character */
+	SDL_Color bg;		/* color of the cell, not drawn if transparent */
+	Uint32 attributes;	/* enum FOX_CellAttributes */
+} FOX_Cell;
+
+/* Creates a grid of blank cells, each FOX_FontMetrics.max_advance wide
+ * and FOX_FontMetrics.height high. Returns NULL on error. */
+extern DECLSPEC FOX_Grid* SDLCALL FOX_CreateGrid(FOX_Font *font,
+												int columns, int rows);
+
+/* Destroys a grid. */
+extern DECLSPEC void SDLCALL FOX_DestroyGrid(FOX_Grid *grid);
+
+/* Sets a cell of a grid. Cells outside of the grid are ignored. */
+extern DECLSPEC void SDLCALL FOX_SetGridCell(FOX_Grid *grid, int column,
+										int row, const FOX_Cell *cell);
+
+/* Returns a cell of a grid or NULL if it is outside of the grid. */
+extern DECLSPEC const FOX_Cell* SDLCALL FOX_GetGridCell(FOX_Grid *grid,
+													int column, int row);
+
+/* Sets cells of a row to the characters of a utf-8 string, up to the end
+ * of the row. Returns the number of cells set. */
+extern DECLSPEC int SDLCALL FOX_SetGridText(FOX_Grid *grid, int column,
+						int row, const Uint8 *text, SDL_Color fg,
+						SDL_Color bg, Uint32 attributes);
+
+/* Scrolls the rows of a grid up by lines, or down if lines is negative,
+ * filling the rows scrolled in with copies of fill or blank cells. */
+extern DECLSPEC void SDLCALL FOX_ScrollGrid(FOX_Grid *grid, int lines,
+												const FOX_Cell *fill);
+
+/* Queries the size of a grid in pixels. */
+extern DECLSPEC void SDLCALL FOX_QueryGridSize(FOX_Grid *grid,
+												int *w, int *h);
+
+/* Renders a grid at the given position. */
+extern DECLSPEC void SDLCALL FOX_RenderGrid(FOX_Grid *grid,
+										const SDL_Point *position);
+
 /******************************************************************************
  * Font metrics and glyph dimensions interface
  *****************************************************************************/
@@ -135,6 +472,41 @@ typedef struct {
 extern DECLSPEC const FOX_FontMetrics* SDLCALL
 FOX_QueryFontMetrics(FOX_Font *font);
 
+/******************************************************************************
+ * Text measurement
+ *****************************************************************************/
+
+/* Specifies the size of a string of text */
+typedef struct {
+	int w;
+	int h;
+	int lines;
+} FOX_TextSize;
+
+/* Measures a utf-8 string of text as FOX_RenderText() would render it. */
+extern DECLSPEC void SDLCALL FOX_MeasureText(FOX_Font *font,
+							const Uint8 *text, FOX_TextSize *size);
+
+/* Measures count utf-8 strings of text at once. */
+extern DECLSPEC void SDLCALL FOX_MeasureTexts(FOX_Font *font,
+		const Uint8 *const *texts, int count, FOX_TextSize *sizes);
+
+/* Returns the number of bytes of the first line of text that fit into
+ * the given width. */
+extern DECLSPEC size_t SDLCALL FOX_FitText(FOX_Font *font,
+						const Uint8 *text, int width, int *extent);
+
+/******************************************************************************
+ * UTF-8 decoding
+ *****************************************************************************/
+
+/* Decodes up to length bytes of utf-8 text into at most max_codepoints
+ * codepoints, substituting U+FFFD for malformed sequences.
+ * Returns the number of codepoints stored. */
+extern DECLSPEC size_t SDLCALL FOX_DecodeUtf8(const Uint8 *text,
+						size_t length, Uint32 *codepoints,
+						size_t max_codepoints, const Uint8 **endptr);
+
 /* end c function definitions when using c++ */
 #ifdef __cplusplus
 }
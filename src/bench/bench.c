@@ -0,0 +1,464 @@
+/******************************************************************************
+ * SDL_fox benchmark
+ *******************
+ * Measures font opening, atlas creation, text rendering, layout and metric
+ * queries without a window, using the dummy video driver and the software
+ * renderer.
+ *
+ * Usage: bench [font file] [seconds per measurement]
+ *
+ * Results are printed one per line as tab separated name, value and unit.
+ * Lines starting with '#' describe the run. Rates are per second.
+ *****************************************************************************/
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "SDL_fox.h"
+
+static const int sizes[] = {12, 24, 48, 96};
+static double duration = 0.5;	/* seconds each measurement runs for */
+static volatile int sink;	/* keeps query results from being optimized out */
+
+static const Uint8 paragraph[] = {
+	"The quick brown fox jumps over the lazy dog. Pack my box with five "
+	"dozen liquor jugs! How vexingly quick daft zebras jump; sphinx of "
+	"black quartz, judge my vow. AVAST, Ye Typographers: kerning pairs "
+	"like AV, To, Wa, Yo and LT deserve attention (1234567890).\n"
+	"\tLorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+	"eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim "
+	"ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut "
+	"aliquip ex ea commodo consequat. Duis aute irure dolor in "
+	"reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla "
+	"pariatur. Excepteur sint occaecat cupidatat non proident, sunt in "
+	"culpa qui officia deserunt mollit anim id est laborum.\n"
+};
+
+static double Now(void) {
+	return (double)SDL_GetPerformanceCounter()
+				/ (double)SDL_GetPerformanceFrequency();
+}
+
+static void Report(const char *name, double value, const char *unit) {
+	printf("%s\t%.8g\t%s\n", name, value, unit);
+	fflush(stdout);
+}
+
+/* A piece of work measured by calling it repeatedly. Returns the number of
+ * items (glyphs, bytes, queries) processed by one call. */
+typedef struct {
+	FOX_Font *font;
+	FOX_Text *text;
+	SDL_Surface *surface;	/* target of surface fonts */
+	size_t length;		/* bytes of the paragraph */
+	size_t chars;		/* characters of the paragraph */
+	FOX_Grid *grid;		/* terminal sized cell grid */
+	int lines;			/* lines written to the grid so far */
+} Context;
+
+typedef double (*BenchFunc)(Context *context);
+
+/* Calls a function for the configured duration after one warm-up call and
+ * returns the items processed per second. */
+static double Rate(BenchFunc func, Context *context) {
+	func(context);
+
+	double items = 0.0, elapsed;
+	double start = Now();
+	do {
+		items += func(context);
+		elapsed = Now() - start;
+	} while(elapsed < duration);
+	return items / elapsed;
+}
+
+/* Returns the fastest of several opens of a font in milliseconds or a
+ * negative value if the font cannot be opened. */
+static double OpenTime(SDL_Renderer *renderer, const char *path, int size,
+								Uint32 flags, FOX_AtlasInfo *info
+) {
+	double best = -1.0, total = 0.0;
+	for(int i = 0; i < 100 && (i < 3 || total < duration); i++) {
+		double start = Now();
+		FOX_Font *font = FOX_OpenFontEx(renderer, path, size, flags);
+		double elapsed = Now() - start;
+		if(!font) return -1.0;
+
+		if(info) FOX_QueryAtlasInfo(font, info);
+		FOX_CloseFont(font);
+		total += elapsed;
+		if(best < 0.0 || elapsed < best) best = elapsed;
+	}
+	return best * 1000.0;
+}
+
+/* Returns the fastest of several asynchronous opens of a font in
+ * milliseconds, counting only the time the caller is blocked, or
+ * a negative value if the font cannot be opened. */
+static double AsyncOpenTime(SDL_Renderer *renderer, const char *path,
+												int size, Uint32 flags
+) {
+	double best = -1.0, total = 0.0;
+	for(int i = 0; i < 100 && (i < 3 || total < duration); i++) {
+		double start = Now();
+		FOX_Font *font = FOX_OpenFontAsync(renderer, path, size, flags);
+		double elapsed = Now() - start;
+		if(!font) return -1.0;
+
+		/* The poll creating the textures blocks the caller as well */
+		enum FOX_FontState state;
+		do {
+			SDL_Delay(1);
+			start = Now();
+			state = FOX_PollFont(font);
+			elapsed += Now() - start;
+		} while(state == FOX_FONT_LOADING);
+		FOX_CloseFont(font);
+		if(state != FOX_FONT_READY) return -1.0;
+
+		total += elapsed;
+		if(best < 0.0 || elapsed < best) best = elapsed;
+	}
+	return best * 1000.0;
+}
+
+static double RenderText(Context *context) {
+	static const SDL_Point position = {0, 0};
+	FOX_RenderText(context->font, paragraph, &position);
+	return (double)context->chars;
+}
+
+/* Renders the paragraph in runs of eight bytes of alternating color */
+static double RenderStyledText(Context *context) {
+	static const SDL_Point position = {0, 0};
+	static FOX_Style styles[sizeof(paragraph) / 8 + 1];
+	int num_styles = (int)SDL_arraysize(styles);
+	for(int i = 0; i < num_styles; i++) {
+		Uint8 shade = i % 2 ? 128 : 255;
+		styles[i] = (FOX_Style){(size_t)i * 8, 8, {255, shade, shade, 255},
+																NULL};
+	}
+	FOX_RenderStyledText(context->font, paragraph, styles, num_styles,
+															&position);
+	return (double)context->chars;
+}
+
+static double RenderTextInside(Context *context) {
+	static const SDL_Rect rect = {0, 0, 600, 768};
+	const Uint8 *text = paragraph, *endptr;
+	while(FOX_RenderTextInside(context->font, text, &endptr, &rect, -1) > 0) {
+		text = endptr;
+	}
+	return (double)context->length;
+}
+
+static double RenderTextBlock(Context *context) {
+	static const SDL_Rect rect = {0, 0, 600, 768};
+	const Uint8 *text = paragraph, *endptr;
+	while(FOX_RenderTextBlock(context->font, text, &endptr, &rect) > 0) {
+		text = endptr;
+	}
+	return (double)context->length;
+}
+
+static double RenderTextObject(Context *context) {
+	static const SDL_Point position = {0, 0};
+	FOX_RenderTextObject(context->text, &position);
+	return (double)context->chars;
+}
+
+/* Terminal dimensions of the grid benchmarks */
+#define GRID_COLUMNS 250
+#define GRID_ROWS 80
+
+static double RenderGrid(Context *context) {
+	static const SDL_Point position = {0, 0};
+	FOX_RenderGrid(context->grid, &position);
+	return GRID_COLUMNS * GRID_ROWS;
+}
+
+/* Scrolls a line of streaming output into the grid and renders it */
+static double StreamGrid(Context *context) {
+	static const SDL_Point position = {0, 0};
+	static const SDL_Color fg = {200, 200, 200, 255}, bg = {0, 0, 0, 0};
+	size_t offset = (size_t)(context->lines++ * 37) % (context->length / 2);
+	FOX_ScrollGrid(context->grid, 1, NULL);
+	FOX_SetGridText(context->grid, 0, GRID_ROWS - 1, paragraph + offset,
+															fg, bg, 0);
+	FOX_RenderGrid(context->grid, &position);
+	return 1.0;
+}
+
+/* Characters cycled through by the atlas budget benchmark */
+#define BUDGET_FIRST 0x20
+#define BUDGET_LAST 0x24F
+#define BUDGET_WINDOW 64
+
+/* Renders the next characters of a range exceeding the atlas budget, so
+ * that glyphs are evicted and rasterized again all the time */
+static double RenderEvicting(Context *context) {
+	static const SDL_Point position = {0, 0};
+	Uint8 text[BUDGET_WINDOW * 2 + 1], *p = text;
+	for(int i = 0; i < BUDGET_WINDOW; i++) {
+		Uint32 ch = BUDGET_FIRST + (Uint32)context->lines++
+								% (BUDGET_LAST - BUDGET_FIRST + 1);
+		if(ch < 0x80) {
+			*p++ = (Uint8)ch;
+		} else {
+			*p++ = (Uint8)(0xC0 | ch >> 6);
+			*p++ = (Uint8)(0x80 | (ch & 0x3F));
+		}
+	}
+	*p = '\0';
+	FOX_RenderText(context->font, text, &position);
+	return BUDGET_WINDOW;
+}
+
+static double RenderTextToSurface(Context *context) {
+	static const SDL_Point position = {0, 0};
+	static const SDL_Color white = {255, 255, 255, 255};
+	FOX_RenderTextToSurface(context->font, context->surface, paragraph,
+														&position, white);
+	return (double)context->chars;
+}
+
+static double LayoutText(Context *context) {
+	FOX_Line lines[64];
+	const Uint8 *text = paragraph;
+	while(*text) {
+		FOX_LayoutText(context->font, text, 600, lines, 64, &text);
+	}
+	return (double)context->length;
+}
+
+static double MeasureText(Context *context) {
+	FOX_TextSize size;
+	FOX_MeasureText(context->font, paragraph, &size);
+	return (double)context->length;
+}
+
+static double QueryGlyphMetrics(Context *context) {
+	for(Uint32 ch = 0x20; ch < 0x7F; ch++) {
+		sink += FOX_QueryGlyphMetrics(context->font, ch) != NULL;
+	}
+	return 0x7F - 0x20;
+}
+
+static double GetKerningOffset(Context *context) {
+	for(Uint32 previous = 'A'; previous <= 'Z'; previous++) {
+		for(Uint32 ch = 'a'; ch <= 'z'; ch++) {
+			sink += FOX_GetKerningOffset(context->font, ch, previous);
+		}
+	}
+	return 26 * 26;
+}
+
+static double GetAdvance(Context *context) {
+	Uint32 previous = 0;
+	for(const Uint8 *c = paragraph; *c; c++) {
+		sink += FOX_GetAdvance(context->font, *c, previous);
+		previous = *c;
+	}
+	return (double)context->length;
+}
+
+static void BenchOpen(SDL_Renderer *renderer, const char *path) {
+	char name[64];
+	for(size_t i = 0; i < SDL_arraysize(sizes); i++) {
+		int size = sizes[i];
+		FOX_AtlasInfo info;
+		double full = OpenTime(renderer, path, size, FOX_OPEN_DEFAULT, &info);
+		double dynamic = OpenTime(renderer, path, size, FOX_OPEN_DYNAMIC, NULL);
+		double parallel = OpenTime(renderer, path, size, FOX_OPEN_PARALLEL,
+																NULL);
+		double async = AsyncOpenTime(renderer, path, size, FOX_OPEN_DEFAULT);
+		if(full < 0.0 || dynamic < 0.0 || parallel < 0.0 || async < 0.0) {
+			fprintf(stderr, "Failed to open %s at size %d\n", path, size);
+			continue;
+		}
+
+		SDL_snprintf(name, sizeof(name), "open.%d.time", size);
+		Report(name, full, "ms");
+		SDL_snprintf(name, sizeof(name), "open.%d.glyphs", size);
+		Report(name, info.glyphs, "count");
+		SDL_snprintf(name, sizeof(name), "open.%d.atlas_pages", size);
+		Report(name, info.pages, "count");
+		SDL_snprintf(name, sizeof(name), "open.%d.atlas_bytes", size);
+		Report(name, (double)info.bytes, "bytes");
+		SDL_snprintf(name, sizeof(name), "open_dynamic.%d.time", size);
+		Report(name, dynamic, "ms");
+		SDL_snprintf(name, sizeof(name), "open_parallel.%d.time", size);
+		Report(name, parallel, "ms");
+		SDL_snprintf(name, sizeof(name), "open_async.%d.blocked_time", size);
+		Report(name, async, "ms");
+
+		/* Opening without rasterizing glyphs only sets up the face */
+		SDL_snprintf(name, sizeof(name), "atlas.%d.time", size);
+		Report(name, full - dynamic, "ms");
+		SDL_snprintf(name, sizeof(name), "atlas.%d.glyph_rate", size);
+		Report(name, full > dynamic ? info.glyphs * 1000.0 / (full - dynamic)
+												: 0.0, "glyphs/s");
+	}
+}
+
+/* Returns the number of characters of the paragraph. */
+static size_t CountChars(void) {
+	static Uint32 chars[sizeof(paragraph)];
+	return FOX_DecodeUtf8(paragraph, sizeof(paragraph) - 1, chars,
+									SDL_arraysize(chars), NULL);
+}
+
+static void BenchText(SDL_Renderer *renderer, const char *path, int size) {
+	Context context = {NULL, NULL, NULL, sizeof(paragraph) - 1, 0, NULL, 0};
+	context.font = FOX_OpenFont(renderer, path, size);
+	if(!context.font) {
+		fprintf(stderr, "Failed to open %s at size %d\n", path, size);
+		return;
+	}
+	context.text = FOX_CreateText(context.font, paragraph);
+	context.chars = CountChars();
+
+	static const struct {
+		const char *name;
+		BenchFunc func;
+		const char *unit;
+	} benchmarks[] = {
+		{"render_text", RenderText, "glyphs/s"},
+		{"render_styled_text", RenderStyledText, "glyphs/s"},
+		{"render_text_inside", RenderTextInside, "bytes/s"},
+		{"render_text_block", RenderTextBlock, "bytes/s"},
+		{"render_text_object", RenderTextObject, "glyphs/s"},
+		{"layout_text", LayoutText, "bytes/s"},
+		{"measure_text", MeasureText, "bytes/s"},
+		{"query_glyph_metrics", QueryGlyphMetrics, "queries/s"},
+		{"get_kerning_offset", GetKerningOffset, "queries/s"},
+		{"get_advance", GetAdvance, "queries/s"}
+	};
+
+	char name[64];
+	for(size_t i = 0; i < SDL_arraysize(benchmarks); i++) {
+		if(!context.text && benchmarks[i].func == RenderTextObject) continue;
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+		SDL_snprintf(name, sizeof(name), "%s.%d.rate",
+										benchmarks[i].name, size);
+		Report(name, Rate(benchmarks[i].func, &context), benchmarks[i].unit);
+	}
+
+	FOX_DestroyText(context.text);
+	FOX_CloseFont(context.font);
+}
+
+static void BenchGrid(SDL_Renderer *renderer, const char *path, int size) {
+	Context context = {NULL, NULL, NULL, sizeof(paragraph) - 1, 0, NULL, 0};
+	context.font = FOX_OpenFont(renderer, path, size);
+	if(context.font) {
+		context.grid = FOX_CreateGrid(context.font, GRID_COLUMNS, GRID_ROWS);
+	}
+	if(!context.grid) {
+		fprintf(stderr, "Failed to create grid of %s at size %d\n",
+															path, size);
+		FOX_CloseFont(context.font);
+		return;
+	}
+
+	/* Fill the screen before measuring */
+	for(int row = 0; row < GRID_ROWS; row++) {
+		StreamGrid(&context);
+	}
+
+	char name[64];
+	SDL_snprintf(name, sizeof(name), "render_grid.%d.rate", size);
+	Report(name, Rate(RenderGrid, &context), "cells/s");
+	SDL_snprintf(name, sizeof(name), "stream_grid.%d.rate", size);
+	Report(name, Rate(StreamGrid, &context), "lines/s");
+	FOX_DestroyGrid(context.grid);
+	FOX_CloseFont(context.font);
+}
+
+static void BenchBudget(SDL_Renderer *renderer, const char *path, int size) {
+	Context context = {NULL, NULL, NULL, sizeof(paragraph) - 1, 0, NULL, 0};
+	context.font = FOX_OpenFontEx(renderer, path, size, FOX_OPEN_DYNAMIC);
+	if(!context.font) {
+		fprintf(stderr, "Failed to open %s at size %d\n", path, size);
+		return;
+	}
+
+	/* Dynamic atlas pages all have the size of the first one */
+	FOX_AtlasInfo info;
+	RenderEvicting(&context);
+	FOX_QueryAtlasInfo(context.font, &info);
+	size_t budget = info.pages > 0 ? 2 * info.bytes / info.pages : 0;
+	if(!FOX_SetAtlasBudget(context.font, budget)) {
+		fprintf(stderr, "Failed to set atlas budget: %s\n", SDL_GetError());
+		FOX_CloseFont(context.font);
+		return;
+	}
+
+	char name[64];
+	SDL_snprintf(name, sizeof(name), "render_evicting.%d.rate", size);
+	Report(name, Rate(RenderEvicting, &context), "glyphs/s");
+	FOX_QueryAtlasInfo(context.font, &info);
+	SDL_snprintf(name, sizeof(name), "render_evicting.%d.atlas_bytes", size);
+	Report(name, (double)info.bytes, "bytes");
+	FOX_CloseFont(context.font);
+}
+
+static void BenchSurface(SDL_Surface *target, const char *path, int size) {
+	Context context = {NULL, NULL, target, sizeof(paragraph) - 1, 0, NULL, 0};
+	context.font = FOX_OpenFontEx(NULL, path, size, FOX_OPEN_SURFACE);
+	if(!context.font) {
+		fprintf(stderr, "Failed to open %s at size %d\n", path, size);
+		return;
+	}
+	context.chars = CountChars();
+
+	char name[64];
+	SDL_snprintf(name, sizeof(name), "render_text_surface.%d.rate", size);
+	Report(name, Rate(RenderTextToSurface, &context), "glyphs/s");
+	FOX_CloseFont(context.font);
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = argc > 1 ? argv[1] : "./bin/OpenSans-Light.ttf";
+	if(argc > 2) duration = SDL_atof(argv[2]);
+
+	/* Run headless unless told otherwise */
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+	if(SDL_Init(SDL_INIT_VIDEO) != 0 || FOX_Init() != FOX_INITIALIZED) {
+		fprintf(stderr, "Initialization failed: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+
+	SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, 1024, 768, 32,
+													SDL_PIXELFORMAT_RGBA32);
+	SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target)
+									: NULL;
+	if(!renderer) {
+		fprintf(stderr, "Failed to create renderer: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+
+	SDL_version version;
+	SDL_GetVersion(&version);
+	printf("# SDL_fox benchmark\n");
+	printf("# font\t%s\n", path);
+	printf("# sdl\t%d.%d.%d\n", version.major, version.minor, version.patch);
+	printf("# cpus\t%d\n", SDL_GetCPUCount());
+	printf("# duration\t%g\n", duration);
+
+	BenchOpen(renderer, path);
+	BenchText(renderer, path, 12);
+	BenchText(renderer, path, 24);
+	BenchGrid(renderer, path, 12);
+	BenchBudget(renderer, path, 24);
+	BenchSurface(target, path, 12);
+	BenchSurface(target, path, 24);
+
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(target);
+	FOX_Exit();
+	SDL_Quit();
+	return EXIT_SUCCESS;
+}
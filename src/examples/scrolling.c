@@ -19,14 +19,18 @@ int main(int argc, char *argv[]) {
 		"Hello World! This is a short message... "
 		"We are currently testing the SDL_fox font "
 		"rendering library. Specifically the "
-		"FOX_RenderTextInside() function. Let's see "
+		"FOX_Reveal object. Let's see "
 		"if this works."
 	};
-	const Uint8 *textptr = text;
-	const Uint8 *endptr = NULL;
+	static const SDL_Rect position = {75, 100, 375, 30*4};
+	FOX_Reveal *reveal = FOX_CreateReveal(font, text, &position);
+	if(!reveal) {
+		puts("Failed to create reveal object!");
+		return -1;
+	}
 	Uint32 ticks = SDL_GetTicks();
-	enum FOX_PrintState printstate = FOX_DONE_PRINTING;
-	int n = 0;
+	Uint32 blink = ticks;
+	enum FOX_PrintState printstate = FOX_MORE_TEXT;
 	SDL_bool swap = SDL_FALSE;
 
 	for(SDL_bool open = SDL_TRUE; open;) {
@@ -34,27 +38,29 @@ int main(int argc, char *argv[]) {
 		while(SDL_PollEvent(&event)) {
 			if(event.type == SDL_QUIT) {
 				open = SDL_FALSE;
-			} else if(event.type == SDL_KEYUP && printstate < FOX_MORE_TEXT) {
-				if(printstate > 0) textptr = endptr;
-				else textptr = text;
-				n = 0;
+			} else if(event.type == SDL_KEYUP) {
+				if(printstate == FOX_MORE_TEXT) {
+					printstate = FOX_RevealChars(reveal, -1);
+				} else {
+					printstate = FOX_NextRevealPage(reveal);
+				}
 			}
 		}
 
+		/* Reveal ten characters per second */
+		Uint32 cticks = SDL_GetTicks();
+		printstate = FOX_RevealTime(reveal, cticks - ticks, 10.0f);
+		ticks = cticks;
+		if((cticks - blink) > 100) {
+			blink = cticks;
+			swap = !swap;
+		}
+
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		static const SDL_Rect position = {75, 100, 375, 30*4};
 		SDL_SetRenderDrawColor(renderer, 255, 255, 150, 255);
-		printstate = FOX_RenderTextInside(font, textptr, &endptr, &position, n);
-
-		Uint32 cticks = SDL_GetTicks();
-		if((cticks - ticks) > 100) {
-			ticks = cticks;
-			printf("n: %d\n", n);
-			if(printstate == FOX_MORE_TEXT) n++;
-			swap = !swap;
-		}
+		FOX_RenderReveal(reveal);
 
 		if(printstate < FOX_MORE_TEXT && swap) {
 			SDL_Rect rect = position;
@@ -73,6 +79,7 @@ int main(int argc, char *argv[]) {
 		SDL_Delay(10);
 	}
 
+	FOX_DestroyReveal(reveal);
 	FOX_CloseFont(font);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);